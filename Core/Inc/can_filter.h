@@ -0,0 +1,96 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef __CAN_FILTER_H
+#define __CAN_FILTER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include "main.h"
+
+/* filter banks of the single bxCAN instance */
+#define CAN_FILTER_BANKS 14U
+
+/* power of two blocks the ranges are split into, further ones are merged right away */
+#define CAN_FILTER_MAX_BLOCKS 64U
+
+/* can_filter_range_t.flags */
+#define CAN_RANGE_EXT   0x01U /* 29 bit identifiers */
+#define CAN_RANGE_RTR   0x02U /* remote frames instead of data frames */
+#define CAN_RANGE_FIFO1 0x04U /* receive through FIFO1 instead of FIFO0 */
+
+/* frame types of the filter words, CAN_FILTER_ANY only in masks */
+#define CAN_FILTER_DATA   0U
+#define CAN_FILTER_REMOTE 1U
+#define CAN_FILTER_ANY    2U
+
+/*
+ * Filter register words, constant expressions for the configuration
+ * tables. A mask accepts first to last, an aligned power of two block.
+ *
+ *   16 bit: STID[15:5] RTR[4] IDE[3] EXID[17:15]
+ *   32 bit: STID[31:21] EXID[20:3] IDE[2] RTR[1]
+ */
+#define CAN_FILTER_STD_WORD(id, frames) \
+  (((uint32_t)(id) << 5) | (((frames) == CAN_FILTER_REMOTE) ? 0x10U : 0U))
+#define CAN_FILTER_STD_MASK(first, last, frames) \
+  (((0x7FFU & ~((uint32_t)(last) - (uint32_t)(first))) << 5) | (((frames) == CAN_FILTER_ANY) ? 0U : 0x10U) | 0x08U)
+#define CAN_FILTER_EXT_WORD(id, frames) \
+  (((uint32_t)(id) << 3) | 0x04U | (((frames) == CAN_FILTER_REMOTE) ? 0x02U : 0U))
+#define CAN_FILTER_EXT_MASK(first, last, frames) \
+  (((0x1FFFFFFFU & ~((uint32_t)(last) - (uint32_t)(first))) << 3) | 0x04U | (((frames) == CAN_FILTER_ANY) ? 0U : 0x02U))
+
+/* first to last is a block a single mask accepts exactly */
+#define CAN_FILTER_IS_BLOCK(first, last, max) \
+  (((first) <= (last)) && ((last) <= (max)) && \
+   ((((last) - (first) + 1U) & ((last) - (first))) == 0U) && (((first) & ((last) - (first))) == 0U))
+
+/* accepted identifiers first to last, a single one with first == last */
+typedef struct
+{
+  uint32_t first;
+  uint32_t last;
+  uint32_t flags;
+} can_filter_range_t;
+
+/* one bank in register layout, FR1/FR2 as written to sFilterRegister */
+typedef struct
+{
+  uint32_t fr1;
+  uint32_t fr2;
+  uint8_t list;  /* identifier list instead of mask mode, FM1R */
+  uint8_t wide;  /* 32 instead of 16 bit scale, FS1R */
+  uint8_t fifo;  /* CAN_FILTER_FIFO0 or CAN_FILTER_FIFO1, FFA1R */
+} can_filter_bank_t;
+
+typedef struct
+{
+  can_filter_bank_t banks[CAN_FILTER_BANKS];
+  uint32_t count;
+  uint32_t false_accepts; /* identifiers accepted beyond the requested set */
+} can_filter_table_t;
+
+/* how can_filter_swap got to the new table */
+typedef struct
+{
+  uint32_t gap_cycles; /* DWT cycles with FINIT set, no frames accepted meanwhile */
+  bool hitless;        /* switched over in one FA1R write, else rewritten in place */
+} can_filter_swap_t;
+
+bool can_filter_compile(const can_filter_range_t *ranges, uint32_t count, uint32_t max_banks,
+                        can_filter_table_t *table);
+HAL_StatusTypeDef can_filter_apply(CAN_HandleTypeDef *hcan, const can_filter_table_t *table);
+void can_filter_write(CAN_TypeDef *can, const can_filter_bank_t *banks, uint32_t count);
+HAL_StatusTypeDef can_filter_apply_config(CAN_HandleTypeDef *hcan);
+uint32_t can_filter_spare(const CAN_HandleTypeDef *hcan);
+HAL_StatusTypeDef can_filter_swap(CAN_HandleTypeDef *hcan, const can_filter_table_t *table, can_filter_swap_t *swap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CAN_FILTER_H */
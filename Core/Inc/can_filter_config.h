@@ -0,0 +1,31 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef __CAN_FILTER_CONFIG_H
+#define __CAN_FILTER_CONFIG_H
+
+/*
+ * Acceptance filters of main_rx and main_bridge when built with
+ * -DCANSHIELD_FILTER_CONFIG=ON, one line per bank in bank order:
+ *
+ *   STD_LIST(fifo, frames, id, id, id, id)               4 x 11 bit
+ *   STD_BLOCKS(fifo, frames, first, last, first, last)   2 x 11 bit block
+ *   EXT_LIST(fifo, frames, id, id)                       2 x 29 bit
+ *   EXT_BLOCK(fifo, frames, first, last)                 1 x 29 bit block
+ *
+ * fifo is CAN_FILTER_FIFO0 or CAN_FILTER_FIFO1, frames CAN_FILTER_DATA,
+ * CAN_FILTER_REMOTE or, for blocks, CAN_FILTER_ANY. A block is a power
+ * of two identifiers starting at a multiple of its size, repeat an entry
+ * to fill a bank. The register values are computed by the compiler, an
+ * entry out of bounds or more than 14 banks fail the build.
+ *
+ * The default routes like RX_SPLIT_STD_ID 0x100 in one bank less.
+ */
+#define CAN_FILTER_CONFIG_TABLE(STD_LIST, STD_BLOCKS, EXT_LIST, EXT_BLOCK)               \
+  STD_BLOCKS(CAN_FILTER_FIFO0, CAN_FILTER_ANY, 0x000U, 0x0FFU, 0x000U, 0x0FFU)          \
+  STD_BLOCKS(CAN_FILTER_FIFO1, CAN_FILTER_ANY, 0x100U, 0x1FFU, 0x200U, 0x3FFU)          \
+  STD_BLOCKS(CAN_FILTER_FIFO1, CAN_FILTER_ANY, 0x400U, 0x7FFU, 0x400U, 0x7FFU)          \
+  EXT_BLOCK(CAN_FILTER_FIFO1, CAN_FILTER_ANY, 0x00000000U, 0x1FFFFFFFU)
+
+#endif /* __CAN_FILTER_CONFIG_H */
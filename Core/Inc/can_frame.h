@@ -0,0 +1,80 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef __CAN_FRAME_H
+#define __CAN_FRAME_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include "main.h"
+
+/*
+ * Frame record in bxCAN mailbox layout, copied word by word from
+ * RIR/RDTR/RDLR/RDHR. The identifier word also matches TIR (except the
+ * TXRQ bit) so the same record can be written to a TX mailbox. The 16-bit
+ * TIME capture is extended to microseconds since start in time_us.
+ */
+typedef struct
+{
+  uint32_t rir;     /* STID[31:21] EXID[20:3] IDE[2] RTR[1] */
+  uint32_t rdtr;    /* TIME[31:16] FMI[15:8] DLC[3:0] */
+  uint32_t data[2]; /* DATA0..DATA7, little endian as in RDLR/RDHR */
+  uint64_t time_us; /* start of frame, see can_rx.c */
+} can_frame_t;
+
+static inline bool can_frame_is_ext(const can_frame_t *frame)
+{
+  return (frame->rir & CAN_RI0R_IDE) != 0U;
+}
+
+static inline bool can_frame_is_rtr(const can_frame_t *frame)
+{
+  return (frame->rir & CAN_RI0R_RTR) != 0U;
+}
+
+static inline uint32_t can_frame_id(const can_frame_t *frame)
+{
+  return can_frame_is_ext(frame) ? (frame->rir >> CAN_RI0R_EXID_Pos) : (frame->rir >> CAN_RI0R_STID_Pos);
+}
+
+static inline uint32_t can_frame_dlc(const can_frame_t *frame)
+{
+  uint32_t dlc = frame->rdtr & CAN_RDT0R_DLC;
+  return (dlc > 8U) ? 8U : dlc;
+}
+
+static inline uint16_t can_frame_time(const can_frame_t *frame)
+{
+  return (uint16_t)(frame->rdtr >> CAN_RDT0R_TIME_Pos);
+}
+
+static inline const uint8_t *can_frame_data(const can_frame_t *frame)
+{
+  return (const uint8_t *)frame->data;
+}
+
+/**
+  * @brief  Fill in identifier and DLC in mailbox layout.
+  * @param  frame record to fill
+  * @param  id 11 or 29 bit identifier
+  * @param  ext true for a 29 bit identifier
+  * @param  rtr true for a remote frame
+  * @param  dlc data length code, 0 to 8
+  * @retval None
+  */
+static inline void can_frame_set_header(can_frame_t *frame, uint32_t id, bool ext, bool rtr, uint32_t dlc)
+{
+  frame->rir = (ext ? ((id << CAN_TI0R_EXID_Pos) | CAN_TI0R_IDE) : (id << CAN_TI0R_STID_Pos)) |
+               (rtr ? CAN_TI0R_RTR : 0U);
+  frame->rdtr = dlc & CAN_TDT0R_DLC;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CAN_FRAME_H */
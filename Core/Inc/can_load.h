@@ -0,0 +1,60 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef __CAN_LOAD_H
+#define __CAN_LOAD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include "main.h"
+#include "can_frame.h"
+
+/* can_tx tags of generated frames, the stuffed frame length in the low bits */
+#define CAN_LOAD_TAG 0x40000000U
+
+/* queue entries left to other senders */
+#define CAN_LOAD_RESERVE 4U
+
+/* can_load_config_t.flags */
+#define CAN_LOAD_EXT        0x01U /* 29 bit identifiers */
+#define CAN_LOAD_SEQUENTIAL 0x02U /* identifiers count up through the range instead of random */
+
+typedef struct
+{
+  uint32_t load_percent; /* target bus load, 1 to 100 */
+  uint32_t id_min;
+  uint32_t id_max;
+  uint32_t flags;
+  uint8_t dlc_weights[9]; /* relative frequency of DLC 0 to 8, all 0 for DLC 8 only */
+  uint32_t seed;          /* payload and choice PRNG, 0 picks a fixed one */
+} can_load_config_t;
+
+/* achieved traffic since can_load_start */
+typedef struct
+{
+  uint64_t elapsed_us;
+  uint64_t bits;            /* stuffed bits of sent frames including interframe space */
+  uint32_t frames;          /* frames sent */
+  uint32_t failed;          /* frames not sent */
+  uint32_t frames_per_s;
+  uint32_t load_permille;   /* bits over bit times elapsed */
+} can_load_stats_t;
+
+void can_load_init(CAN_HandleTypeDef *hcan);
+bool can_load_start(const can_load_config_t *config);
+void can_load_stop(void);
+bool can_load_running(void);
+void can_load_poll(void);
+void can_load_stats(can_load_stats_t *stats);
+void can_load_done(uint32_t tag, uint32_t status, uint64_t time_us);
+uint32_t can_load_frame_bits(const can_frame_t *frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CAN_LOAD_H */
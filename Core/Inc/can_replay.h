@@ -0,0 +1,61 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef __CAN_REPLAY_H
+#define __CAN_REPLAY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include "main.h"
+#include "can_frame.h"
+
+/* trace records buffered ahead of playback, power of two */
+#define CAN_REPLAY_BUFFER 64U
+
+/* per frame results buffered between the CAN TX interrupt and the main loop, power of two */
+#define CAN_REPLAY_RESULTS 32U
+
+/* can_tx tags of replayed frames, the trace frame number in the low 16 bits */
+#define CAN_REPLAY_TAG 0x20000000U
+
+/* outcome of one replayed frame */
+typedef struct
+{
+  int32_t error_us; /* start of frame minus its trace time, 0 if not sent */
+  uint16_t index;   /* trace frame number since can_replay_start */
+  uint8_t status;   /* CAN_TX_* */
+} can_replay_result_t;
+
+/* playback statistics since can_replay_start */
+typedef struct
+{
+  uint32_t released;      /* frames handed to can_tx */
+  uint32_t sent;
+  uint32_t failed;        /* released but not sent */
+  uint32_t underruns;     /* buffer ran empty and the next record arrived late */
+  int32_t min_error_us;
+  int32_t max_error_us;
+  int32_t mean_error_us;
+  uint32_t results_lost;  /* per frame results not fetched in time */
+} can_replay_stats_t;
+
+void can_replay_init(TIM_HandleTypeDef *htim);
+bool can_replay_push(const can_frame_t *frame, uint32_t time_us);
+void can_replay_end(void);
+uint32_t can_replay_free(void);
+bool can_replay_start(uint32_t delay_us);
+void can_replay_stop(void);
+bool can_replay_running(void);
+void can_replay_stats(can_replay_stats_t *stats);
+uint32_t can_replay_results(can_replay_result_t *results, uint32_t max);
+void can_replay_done(uint32_t tag, uint32_t status, uint64_t time_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CAN_REPLAY_H */
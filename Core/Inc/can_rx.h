@@ -0,0 +1,36 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef __CAN_RX_H
+#define __CAN_RX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include "main.h"
+#include "can_frame.h"
+
+/* Frames buffered between the CAN RX interrupt and the main loop, power of two */
+#define CAN_RX_RING_SIZE 64U
+
+HAL_StatusTypeDef can_rx_config_filters(CAN_HandleTypeDef *hcan, uint32_t split_std_id);
+HAL_StatusTypeDef can_rx_start(CAN_HandleTypeDef *hcan);
+uint32_t can_rx_drain_fifo(CAN_TypeDef *can, uint32_t RxFifo, can_frame_t *frames, uint32_t max);
+bool can_rx_pop(can_frame_t *frame);
+
+uint32_t can_rx_depth(void);
+uint32_t can_rx_high_water(void);
+uint32_t can_rx_dropped(void);
+uint32_t can_rx_fifo_count(uint32_t RxFifo);
+uint32_t can_rx_fifo_full(uint32_t RxFifo);
+uint32_t can_rx_fifo_overrun(uint32_t RxFifo);
+uint32_t can_rx_cycles_per_frame(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CAN_RX_H */
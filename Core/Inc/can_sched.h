@@ -0,0 +1,53 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef __CAN_SCHED_H
+#define __CAN_SCHED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include "main.h"
+#include "can_frame.h"
+
+/* Periodic frames in the schedule table */
+#define CAN_SCHED_MAX_ENTRIES 100U
+
+#define CAN_SCHED_MIN_PERIOD_US 100U
+
+/* let the device pick the offset, entries are spread CAN_SCHED_STAGGER_US apart */
+#define CAN_SCHED_AUTO_OFFSET 0xFFFFFFFFU
+/* about one 8 byte frame at 500 kbit/s */
+#define CAN_SCHED_STAGGER_US  250U
+
+/* can_tx tags of scheduled frames, the entry index in the low bits */
+#define CAN_SCHED_TAG 0x80000000U
+
+/* per entry statistics since can_sched_start */
+typedef struct
+{
+  uint32_t count;         /* frames transmitted */
+  uint32_t min_period_us; /* shortest time between two transmissions */
+  uint32_t max_period_us; /* longest time between two transmissions */
+  uint32_t jitter_us;     /* largest deviation of the actual from the nominal period */
+  uint32_t missed;        /* releases skipped or failed: frame still pending, queue full, not sent */
+} can_sched_stats_t;
+
+void can_sched_init(TIM_HandleTypeDef *htim);
+bool can_sched_set(uint32_t index, const can_frame_t *frame, uint32_t period_us, uint32_t offset_us);
+void can_sched_clear(void);
+uint32_t can_sched_size(void);
+bool can_sched_start(void);
+void can_sched_stop(void);
+bool can_sched_running(void);
+void can_sched_stats(uint32_t index, can_sched_stats_t *stats);
+void can_sched_done(uint32_t tag, uint32_t status, uint64_t time_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CAN_SCHED_H */
@@ -0,0 +1,34 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef __CAN_TIME_H
+#define __CAN_TIME_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include "main.h"
+
+/* Extension state of one sequence of TIME captures */
+typedef struct
+{
+  uint32_t bit_ns;
+  uint32_t half_wrap_us;
+  bool synced;
+  uint16_t last_time;
+  uint64_t last_us;
+  uint32_t last_frac_ns;
+} can_time_t;
+
+uint32_t can_time_bit_ns(const CAN_TypeDef *can);
+void can_time_init(can_time_t *clock, const CAN_TypeDef *can);
+uint64_t can_time_extend(can_time_t *clock, uint16_t time, uint64_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CAN_TIME_H */
@@ -0,0 +1,71 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef __CAN_TX_H
+#define __CAN_TX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include "main.h"
+#include "can_frame.h"
+
+/* Frames queued or in a TX mailbox */
+#define CAN_TX_QUEUE_SIZE 32U
+
+/* Queueing delay is tracked per class, the top bits of the base identifier */
+#define CAN_TX_CLASS_BITS 3U
+#define CAN_TX_CLASSES    (1U << CAN_TX_CLASS_BITS)
+
+#define CAN_TX_NO_TAG 0U
+#define CAN_TX_NO_DEADLINE 0U
+
+/* Identifiers with their own expired frame counter */
+#define CAN_TX_EXPIRED_IDS 16U
+/* can_tx_expired_t.id flag of an extended identifier */
+#define CAN_TX_ID_EXT 0x80000000U
+
+/* outcome of a frame leaving its mailbox */
+#define CAN_TX_SENT    0U
+#define CAN_TX_ALST    1U /* arbitration lost */
+#define CAN_TX_TERR    2U /* transmit error */
+#define CAN_TX_ABORTED 3U
+#define CAN_TX_EXPIRED 4U /* deadline passed before it was sent */
+
+/* frame left its mailbox: tag from can_tx_queue, CAN_TX_* outcome, time in us */
+typedef void (*can_tx_done_t)(uint32_t tag, uint32_t status, uint64_t time_us);
+
+typedef struct
+{
+  uint32_t id;    /* identifier, CAN_TX_ID_EXT for extended ones */
+  uint32_t count; /* frames dropped at their deadline */
+} can_tx_expired_t;
+
+HAL_StatusTypeDef can_tx_start(CAN_HandleTypeDef *hcan);
+void can_tx_set_fifo_mode(bool fifo);
+void can_tx_set_retry(uint32_t limit, uint32_t deadline_us, uint32_t backoff_us);
+void can_tx_get_retry(uint32_t *limit, uint32_t *deadline_us, uint32_t *backoff_us);
+void can_tx_poll(void);
+void can_tx_set_done_callback(can_tx_done_t callback);
+bool can_tx_queue(const can_frame_t *frame, uint32_t tag, uint32_t lifetime_us);
+uint32_t can_tx_free(void);
+
+uint32_t can_tx_sent(void);
+uint32_t can_tx_failed(void);
+uint32_t can_tx_rejected(void);
+uint32_t can_tx_preempted(void);
+uint32_t can_tx_retries(void);
+uint32_t can_tx_give_ups(void);
+uint32_t can_tx_expired(void);
+uint32_t can_tx_expired_ids(can_tx_expired_t *ids, uint32_t max, uint32_t *untracked);
+uint32_t can_tx_high_water(void);
+uint32_t can_tx_max_delay(uint32_t cls);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CAN_TX_H */
@@ -0,0 +1,35 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef __HOST_LINK_H
+#define __HOST_LINK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include "main.h"
+#include "host_proto.h"
+
+/* HOST_MSG_BAUD status */
+#define HOST_BAUD_ACCEPTED  0x00U /* sent at the old rate, switching after it */
+#define HOST_BAUD_REJECTED  0x01U /* rate not reachable within 2 % */
+#define HOST_BAUD_VERIFIED  0x02U /* ping received at the new rate */
+#define HOST_BAUD_REVERTED  0x03U /* no ping in time, back at the last working rate */
+
+/* Time the host has to ping at the new rate before the device falls back */
+#define HOST_LINK_VERIFY_TIMEOUT_MS 1000U
+
+void host_link_init(UART_HandleTypeDef *huart);
+bool host_link_handle(const host_packet_t *packet);
+void host_link_poll(void);
+bool host_link_switching(void);
+uint32_t host_link_baud(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HOST_LINK_H */
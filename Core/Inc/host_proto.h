@@ -0,0 +1,276 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef __HOST_PROTO_H
+#define __HOST_PROTO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include "main.h"
+#include "can_frame.h"
+
+/*
+ * Host link packets, all fields little endian:
+ *
+ *   type u8 | payload ... | crc32 u32
+ *
+ * The CRC is the one of the CRC unit, CRC-32/MPEG-2 (poly 0x04C11DB7,
+ * init 0xFFFFFFFF, no reflection, no final xor), fed with type and payload
+ * as little endian 32-bit words, the last word zero padded. The packet is
+ * then COBS encoded and terminated with 0x00, so a receiver resynchronises
+ * at the next zero byte after line noise.
+ */
+#define HOST_MSG_FRAMES 0x01U /* seq u16 of the first record | record ... */
+#define HOST_MSG_TEXT   0x02U /* ASCII, reset banner and diagnostics */
+#define HOST_MSG_BAUD   0x03U /* status u8 | baud u32, see HOST_BAUD_* */
+#define HOST_MSG_PONG   0x04U /* uart errors u32 | host input dropped u32 | bad packets u32 | ping payload */
+#define HOST_MSG_STATS  0x05U /* host_stats_t */
+#define HOST_MSG_TX_ACK 0x06U /* seq u16 | count u8 | failures: index u8 | status u8, see HOST_TX_* */
+#define HOST_MSG_SCHED_ACK   0x07U /* command u8 | status u8 | table size u8, see HOST_SCHED_* */
+#define HOST_MSG_SCHED_STATS 0x08U /* first index u8 | per entry: count, min, max, jitter, missed u32 */
+#define HOST_MSG_TX_CONFIRM  0x09U /* lost u32 | confirmation ..., see HOST_CONFIRM_* */
+#define HOST_MSG_EXPIRED     0x0AU /* total u32 | untracked u32 | per identifier: id u32 | count u32 */
+#define HOST_MSG_LOAD_STATS  0x0BU /* see HOST_CMD_LOAD_START */
+#define HOST_MSG_REPLAY_STATUS  0x0CU /* see HOST_CMD_REPLAY_DATA */
+#define HOST_MSG_REPLAY_RESULTS 0x0DU /* lost u32 | per frame: index u16 | status u8 | error us i32 */
+#define HOST_MSG_FILTER_RESULT  0x0EU /* see HOST_CMD_SET_FILTERS */
+#define HOST_MSG_COALESCE       0x0FU /* status u8 | max bytes u16 | max delay us u32 | adaptive u8, in effect */
+#define HOST_MSG_RETRY          0x10U /* status u8 | retries u8 | deadline us u32 | backoff us u32, in effect */
+
+/* Host to device packets use the same framing */
+#define HOST_CMD_SET_BAUD     0x40U /* baud u32 */
+#define HOST_CMD_PING         0x41U /* any payload, echoed in HOST_MSG_PONG */
+#define HOST_CMD_SET_COALESCE 0x42U /* max bytes u16 | max delay us u32 | adaptive u8, answered with HOST_MSG_COALESCE */
+#define HOST_CMD_GET_STATS    0x43U /* no payload, answered with HOST_MSG_STATS */
+#define HOST_CMD_TX           0x50U /* seq u16 | TX record ..., answered with HOST_MSG_TX_ACK */
+#define HOST_CMD_SCHED_LOAD   0x51U /* first index u8 | schedule record ... */
+#define HOST_CMD_SCHED_START  0x52U /* no payload */
+#define HOST_CMD_SCHED_STOP   0x53U /* no payload */
+#define HOST_CMD_SCHED_STATS  0x54U /* first index u8 | count u8, answered with HOST_MSG_SCHED_STATS */
+#define HOST_CMD_SET_RETRY    0x55U /* retries u8 | deadline us u32 | backoff us u32, answered with HOST_MSG_RETRY */
+#define HOST_CMD_TX_TIMED     0x56U /* seq u16 | lifetime us u32 | TX record ..., answered with HOST_MSG_TX_ACK */
+#define HOST_CMD_GET_EXPIRED  0x57U /* no payload, answered with HOST_MSG_EXPIRED */
+#define HOST_CMD_LOAD_START   0x58U /* see below, answered with HOST_MSG_LOAD_STATS */
+#define HOST_CMD_LOAD_STOP    0x59U /* no payload, answered with HOST_MSG_LOAD_STATS */
+#define HOST_CMD_LOAD_STATS   0x5AU /* no payload, answered with HOST_MSG_LOAD_STATS */
+#define HOST_CMD_REPLAY_DATA   0x5BU /* flags u8 | replay record ..., answered with HOST_MSG_REPLAY_STATUS */
+#define HOST_CMD_REPLAY_START  0x5CU /* delay us u32, answered with HOST_MSG_REPLAY_STATUS */
+#define HOST_CMD_REPLAY_STOP   0x5DU /* no payload, answered with HOST_MSG_REPLAY_STATUS */
+#define HOST_CMD_REPLAY_STATUS 0x5EU /* no payload, answered with HOST_MSG_REPLAY_STATUS */
+#define HOST_CMD_SET_FILTERS   0x5FU /* max banks u8 | filter range ..., answered with HOST_MSG_FILTER_RESULT */
+
+/*
+ * HOST_MSG_FRAMES carries as many frame records as fit, each one
+ *
+ *   flags u8 | id u32 | timestamp u64 | data[dlc]
+ *
+ * with no data bytes for remote frames, as in the TX records.
+ *
+ * The timestamp is the start of frame in microseconds since reset, taken
+ * from the CAN time stamp counter, not from the arrival on the host.
+ *
+ * Records are numbered consecutively from the packet sequence number, a
+ * gap to the previous packet means frames were lost on the way.
+ */
+#define HOST_FRAME_DLC_Msk 0x0FU
+#define HOST_FRAME_IDE     0x10U
+#define HOST_FRAME_RTR     0x20U
+
+#define HOST_PROTO_MAX_PAYLOAD 252U
+/* worst case bytes on the wire for one packet: COBS overhead and delimiter */
+#define HOST_PROTO_MAX_WIRE (1U + HOST_PROTO_MAX_PAYLOAD + 4U + 2U + 1U)
+/* decoded host packets waiting for the main loop, one of them held by the caller */
+#define HOST_PROTO_RX_SLOTS 3U
+/*
+ * HOST_CMD_TX carries a batch of records, numbered from seq on, each one
+ *
+ *   flags u8 | id u32 | data[dlc]
+ *
+ * with the flags of HOST_MSG_FRAMES, a remote frame carries no data bytes.
+ * A standard identifier must fit 11 bits, an extended one 29 bits.
+ *
+ * The whole batch is answered with one HOST_MSG_TX_ACK: the seq of the
+ * command, the number of records processed and only the records that
+ * were not queued. Parsing stops at a malformed record, records after it
+ * are not counted. A packet too short for its header is answered with
+ * record 0 malformed, and seq 0 if the seq itself is missing.
+ *
+ * HOST_CMD_TX_TIMED gives every frame of the batch a lifetime from
+ * queueing, 0 for none. A frame not sent by then is discarded from the
+ * queue or aborted in its mailbox and confirmed as HOST_CONFIRM_EXPIRED.
+ * HOST_MSG_EXPIRED counts them per identifier (bit 31 set for extended
+ * ones) for the first 16 identifiers, untracked covers the rest.
+ */
+#define HOST_TX_QUEUED    0x00U
+#define HOST_TX_FULL      0x01U /* TX queue full, frame dropped */
+#define HOST_TX_MALFORMED 0x02U /* bad flags, identifier or length */
+
+/*
+ * Every queued frame of HOST_CMD_TX is confirmed once it left its mailbox,
+ * several confirmations share a HOST_MSG_TX_CONFIRM packet, each one
+ *
+ *   seq u16 | status u8 | timestamp u64
+ *
+ * with the record number from HOST_CMD_TX. The timestamp is the start of
+ * frame taken from the mailbox TIME field for a sent frame, the time the
+ * outcome was known otherwise. lost counts confirmations that did not fit
+ * the device buffer since reset.
+ */
+#define HOST_CONFIRM_SENT    0x00U
+#define HOST_CONFIRM_ALST    0x01U /* arbitration lost, retries used up */
+#define HOST_CONFIRM_TERR    0x02U /* transmit error, retries used up */
+#define HOST_CONFIRM_ABORTED 0x03U
+#define HOST_CONFIRM_EXPIRED 0x04U /* lifetime passed before it was sent */
+#define HOST_CONFIRM_RECORD  11U
+
+/*
+ * HOST_CMD_SCHED_LOAD fills the schedule table of main_tx from the given
+ * index on, loading index 0 replaces the whole table. Each record is
+ *
+ *   period us u32 | offset us u32 | TX record
+ *
+ * with offset 0xFFFFFFFF to let the device stagger the entries. LOAD,
+ * START and STOP are answered with HOST_MSG_SCHED_ACK. The table can only
+ * be loaded while stopped. SCHED_STATS returns the statistics since the
+ * last start for as many entries as fit one packet, none for a request
+ * shorter than index and count.
+ */
+#define HOST_SCHED_OK        0x00U
+#define HOST_SCHED_RUNNING   0x01U /* stop the schedule first */
+#define HOST_SCHED_MALFORMED 0x02U /* bad record, index or period, entries before it were stored */
+#define HOST_SCHED_EMPTY     0x03U /* nothing to start */
+
+/*
+ * HOST_CMD_LOAD_START runs the bus load generator of main_tx:
+ *
+ *   load % u8 | id min u32 | id max u32 | flags u8 | DLC 0..8 weights 9 x u8 | seed u32
+ *
+ * flags bit 0 selects 29 bit identifiers, bit 1 counts the identifiers up
+ * through the range instead of drawing them at random. All weights 0 send
+ * 8 data bytes only. HOST_MSG_LOAD_STATS reports what was achieved since
+ * the start:
+ *
+ *   status u8 | running u8 | elapsed us u64 | frames u32 | failed u32 |
+ *   bits u64 | frames per s u32 | load permille u32
+ *
+ * where bits counts the stuffed length of every sent frame including the
+ * interframe space, and load is their share of the bit times elapsed.
+ */
+#define HOST_LOAD_OK        0x00U
+#define HOST_LOAD_MALFORMED 0x01U /* short payload, load or identifier range out of bounds */
+#define HOST_LOAD_CONFIG    23U
+
+/*
+ * HOST_CMD_REPLAY_DATA buffers trace records for device timed playback,
+ * before and while it runs. Each record is
+ *
+ *   trace time us u32 | TX record
+ *
+ * in time order, flags bit 0 marks the last packet of the trace. STOP
+ * discards the buffer and the time base, send it before a new trace. The
+ * first record buffered after it plays delay us after START. Every
+ * command is answered with
+ *
+ *   status u8 | running u8 | records stored u8 | free u16 | released u32 |
+ *   sent u32 | failed u32 | underruns u32 | error us min, max, mean i32 |
+ *   results lost u32
+ *
+ * where free is the room left to refill and error is the start of frame
+ * of a sent frame minus its trace time. HOST_MSG_REPLAY_RESULTS reports
+ * every frame with the number it had in the trace, counted from START.
+ */
+#define HOST_REPLAY_OK        0x00U
+#define HOST_REPLAY_MALFORMED 0x01U /* bad record or time running backwards, records before it were stored */
+#define HOST_REPLAY_FULL      0x02U /* buffer full, records before it were stored */
+#define HOST_REPLAY_REFUSED   0x03U /* START while running or with nothing buffered */
+#define HOST_REPLAY_RESULT    7U
+
+/*
+ * HOST_CMD_SET_FILTERS replaces the acceptance filters of main_rx and
+ * main_bridge with the given identifier ranges, each
+ *
+ *   flags u8 | first id u32 | last id u32
+ *
+ * with the CAN_RANGE_* flags: bit 0 29 bit identifiers, bit 1 remote
+ * frames, bit 2 FIFO1. No range receives nothing. If the ranges need
+ * more than max banks they are widened to fit. Max banks 0 takes the
+ * banks not in use, so the switch is hitless. The answer is
+ *
+ *   status u8 | banks used u8 | false accepts u32 | hitless u8 | gap ns u32
+ *
+ * where false accepts counts the identifiers received on top of the
+ * requested ones. A hitless switch fills free banks while the old ones
+ * keep filtering and swaps them in one register write, gap is the time
+ * no frames were accepted while the bank modes were changed, 0 if they
+ * already matched. Otherwise the banks were rewritten in place.
+ */
+#define HOST_FILTER_OK        0x00U
+#define HOST_FILTER_MALFORMED 0x01U /* bad length, max banks or range, filters unchanged */
+#define HOST_FILTER_FAILED    0x02U /* CAN not initialised, filters unchanged, rest of the answer 0 */
+#define HOST_FILTER_RANGE     9U
+
+/* largest frame record, 8 data bytes */
+#define HOST_FRAME_RECORD_MAX (13U + 8U)
+
+/*
+ * Frame records are coalesced into one packet until it holds max bytes of
+ * payload or the oldest record waited max delay us. In adaptive mode a
+ * packet is also flushed as soon as the UART has nothing else to send, so
+ * a quiet bus gets one frame per packet and a busy one fills the packets.
+ */
+#define HOST_COALESCE_DEFAULT_BYTES HOST_PROTO_MAX_PAYLOAD
+#define HOST_COALESCE_DEFAULT_US    1000U
+#define HOST_COALESCE_MAX_US        1000000U /* longer delays are clamped */
+#define HOST_COALESCE_OK            0x00U
+#define HOST_COALESCE_MALFORMED     0x01U /* bad length, settings unchanged */
+
+/* HOST_MSG_RETRY status, the policy in effect follows either way */
+#define HOST_RETRY_OK        0x00U
+#define HOST_RETRY_MALFORMED 0x01U /* bad length, policy unchanged */
+
+/*
+ * HOST_MSG_STATS payload, all counters since reset. Sent on request and
+ * whenever one of the loss or backlog counters changed.
+ */
+typedef struct
+{
+  uint32_t rx_frames[2];         /* frames taken from FIFO0 / FIFO1 */
+  uint32_t fifo_full[2];         /* FULL flag seen, FIFO held 3 frames */
+  uint32_t fifo_overrun[2];      /* FOVR flag seen, at least one frame lost in hardware */
+  uint32_t ring_dropped;         /* frames lost because the RX ring was full */
+  uint32_t ring_high_water;      /* frames */
+  uint32_t uart_tx_high_water;   /* bytes */
+  uint32_t uart_tx_dropped;      /* packets that did not fit the UART ring */
+  uint32_t uart_rx_dropped;      /* host bytes or whole packets lost */
+  uint32_t uart_rx_errors;
+  uint32_t bad_packets;          /* host packets failing COBS or CRC */
+} host_stats_t;
+
+typedef struct
+{
+  uint8_t type;
+  uint32_t len;
+  const uint8_t *payload; /* valid until the next host_proto_receive */
+} host_packet_t;
+
+void host_proto_init(CRC_HandleTypeDef *hcrc);
+void host_proto_rx_parse(const uint8_t *data, uint32_t len);
+bool host_proto_receive(host_packet_t *packet);
+uint32_t host_proto_bad_packets(void);
+uint32_t host_proto_dropped_packets(void);
+bool host_proto_send(uint8_t type, const void *payload, uint32_t len);
+bool host_proto_send_frame(const can_frame_t *frame);
+uint32_t host_proto_parse_frame(const uint8_t *data, uint32_t len, can_frame_t *frame);
+void host_proto_set_coalescing(uint32_t max_bytes, uint32_t max_us, bool adaptive);
+bool host_proto_flush(void);
+void host_proto_poll(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HOST_PROTO_H */
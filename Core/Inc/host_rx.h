@@ -0,0 +1,24 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef __HOST_RX_H
+#define __HOST_RX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include "host_proto.h"
+
+void host_rx_init(CAN_HandleTypeDef *hcan);
+bool host_rx_handle(const host_packet_t *packet);
+void host_rx_poll(uint32_t reserve);
+void host_rx_report(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HOST_RX_H */
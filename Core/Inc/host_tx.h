@@ -0,0 +1,24 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef __HOST_TX_H
+#define __HOST_TX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include "host_proto.h"
+
+void host_tx_init(void);
+bool host_tx_handle(const host_packet_t *packet);
+void host_tx_poll(void);
+void host_tx_report(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HOST_TX_H */
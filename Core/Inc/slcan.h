@@ -0,0 +1,28 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef __SLCAN_H
+#define __SLCAN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include "main.h"
+#include "can_frame.h"
+
+/* Longest line sent for a received frame: T iiiiiiii l dd*8 tttt \r */
+#define SLCAN_MAX_FRAME_LEN (1U + 8U + 1U + 16U + 4U + 1U)
+
+void slcan_init(CAN_HandleTypeDef *hcan);
+void slcan_process(void);
+bool slcan_send_frame(const can_frame_t *frame);
+bool slcan_is_open(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SLCAN_H */
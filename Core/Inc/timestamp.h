@@ -0,0 +1,26 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef __TIMESTAMP_H
+#define __TIMESTAMP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+#define TIMESTAMP_CHANNELS 4U
+
+typedef void (*timestamp_compare_t)(void);
+
+HAL_StatusTypeDef timestamp_start(TIM_HandleTypeDef *htim);
+uint64_t timestamp_now_us(void);
+void timestamp_set_compare_callback(uint32_t channel, timestamp_compare_t callback);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TIMESTAMP_H */
@@ -0,0 +1,35 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef __UART_RX_H
+#define __UART_RX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+/* Circular DMA buffer for bytes from the host link, power of two */
+#define UART_RX_BUFFER_SIZE 256U
+
+/**
+  * @brief  Stream parser fed from the UART interrupt.
+  * @note   Called with every run of new bytes on idle line, half and full
+  *         buffer. data is NULL and len 0 after bytes were lost, the parser
+  *         must resynchronise on its next delimiter.
+  */
+typedef void (*uart_rx_parser_t)(const uint8_t *data, uint32_t len);
+
+void uart_rx_start(UART_HandleTypeDef *huart, uart_rx_parser_t parser);
+uint32_t uart_rx_read(uint8_t *data, uint32_t max);
+
+uint32_t uart_rx_dropped(void);
+uint32_t uart_rx_errors(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UART_RX_H */
@@ -0,0 +1,30 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef __UART_TX_H
+#define __UART_TX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include "main.h"
+
+/* Bytes buffered for the host link, power of two */
+#define UART_TX_BUFFER_SIZE 2048U
+
+void uart_tx_init(UART_HandleTypeDef *huart);
+bool uart_tx_write(const void *data, uint32_t len);
+uint32_t uart_tx_free(void);
+bool uart_tx_idle(void);
+
+uint32_t uart_tx_high_water(void);
+uint32_t uart_tx_dropped(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UART_TX_H */
@@ -0,0 +1,758 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "can_filter.h"
+#include "can_filter_config.h"
+
+/*
+ * Filter bank compiler. Every range is split into aligned power of two
+ * blocks, the form a single mask filter accepts exactly. A bank holds
+ *
+ *   16 bit list: 4 standard identifiers
+ *   16 bit mask: 2 standard blocks
+ *   32 bit list: 2 extended identifiers
+ *   32 bit mask: 1 extended block
+ *
+ * so the bank count of a set follows from the number of single
+ * identifiers and larger blocks per class (frame format, data or remote,
+ * FIFO). A leftover standard identifier shares the spare half of a 16 bit
+ * mask bank.
+ *
+ * While the set needs more banks than given, the two neighbouring blocks
+ * of a class whose smallest common block adds the fewest identifiers are
+ * merged. The result is a superset of the request, false_accepts counts
+ * the identifiers it lets through on top. A merged block may also cover
+ * identifiers asked for in the other FIFO, the bank with the higher
+ * priority then decides where they go. Only if there are more classes
+ * than banks everything is accepted into FIFO0.
+ *
+ * Blocks are kept sorted by class and identifier. Aligned blocks either
+ * nest or do not overlap, so a merged block covers exactly the run of
+ * blocks between its two ends.
+ */
+typedef struct
+{
+  uint32_t id;  /* first identifier, aligned to the block size */
+  uint8_t bits; /* log2 of the block size */
+  uint8_t cls;  /* CAN_RANGE_EXT, _RTR and _FIFO1 of the range */
+} block_t;
+
+#define CLASSES 8U
+
+static block_t blocks[CAN_FILTER_MAX_BLOCKS];
+static uint32_t block_count;
+
+static uint32_t id_bits(uint32_t cls)
+{
+  return ((cls & CAN_RANGE_EXT) != 0U) ? 29U : 11U;
+}
+
+static uint32_t block_end(const block_t *block)
+{
+  return block->id + (1UL << block->bits);
+}
+
+/**
+  * @brief  Banks needed by one class.
+  * @param  cls class
+  * @param  singles set to the number of single identifiers
+  * @param  masks set to the number of larger blocks
+  * @retval banks
+  */
+static uint32_t class_banks(uint32_t cls, uint32_t *singles, uint32_t *masks)
+{
+  uint32_t s = 0U;
+  uint32_t m = 0U;
+
+  for (uint32_t i = 0U; i < block_count; i++)
+  {
+    if (blocks[i].cls == cls)
+    {
+      if (blocks[i].bits == 0U)
+      {
+        s++;
+      }
+      else
+      {
+        m++;
+      }
+    }
+  }
+  *singles = s;
+  *masks = m;
+
+  if ((cls & CAN_RANGE_EXT) != 0U)
+  {
+    return ((s + 1U) / 2U) + m;
+  }
+
+  uint32_t banks = ((s + 3U) / 4U) + ((m + 1U) / 2U);
+  if (((s % 4U) == 1U) && ((m % 2U) == 1U))
+  {
+    banks--;
+  }
+  return banks;
+}
+
+static uint32_t total_banks(void)
+{
+  uint32_t banks = 0U;
+  uint32_t singles;
+  uint32_t masks;
+
+  for (uint32_t cls = 0U; cls < CLASSES; cls++)
+  {
+    banks += class_banks(cls, &singles, &masks);
+  }
+  return banks;
+}
+
+/**
+  * @brief  Smallest block covering a block and its successor.
+  * @param  i index of the first block, the next one has the same class
+  * @param  merged set to the covering block
+  * @param  end set to the index after the last block it covers
+  * @retval identifiers it adds to the accepted set
+  */
+static uint32_t merge_cost(uint32_t i, block_t *merged, uint32_t *end)
+{
+  const block_t *a = &blocks[i];
+  const block_t *b = &blocks[i + 1U];
+  uint32_t bits = (a->bits > b->bits) ? a->bits : b->bits;
+  uint32_t covered = 0U;
+  uint32_t j = i;
+
+  while ((a->id >> bits) != (b->id >> bits))
+  {
+    bits++;
+  }
+
+  merged->bits = (uint8_t)bits;
+  merged->cls = a->cls;
+  merged->id = a->id & ~((1UL << bits) - 1U);
+
+  while ((j < block_count) && (blocks[j].cls == a->cls) && (blocks[j].id < block_end(merged)))
+  {
+    covered += 1UL << blocks[j].bits;
+    j++;
+  }
+  *end = j;
+
+  return (uint32_t)((1UL << bits) - covered);
+}
+
+/**
+  * @brief  Merge the neighbouring pair that adds the fewest identifiers.
+  * @retval false if no class has two blocks left
+  */
+static bool merge_cheapest(void)
+{
+  uint32_t best = block_count;
+  uint32_t best_cost = UINT32_MAX;
+
+  for (uint32_t i = 0U; i + 1U < block_count; i++)
+  {
+    block_t merged;
+    uint32_t end;
+
+    if (blocks[i].cls != blocks[i + 1U].cls)
+    {
+      continue;
+    }
+
+    uint32_t cost = merge_cost(i, &merged, &end);
+    if ((best == block_count) || (cost < best_cost))
+    {
+      best = i;
+      best_cost = cost;
+    }
+  }
+
+  if (best == block_count)
+  {
+    return false;
+  }
+
+  block_t merged;
+  uint32_t end;
+
+  merge_cost(best, &merged, &end);
+  blocks[best] = merged;
+  for (uint32_t j = end; j < block_count; j++)
+  {
+    blocks[best + 1U + (j - end)] = blocks[j];
+  }
+  block_count -= end - best - 1U;
+  return true;
+}
+
+/**
+  * @brief  Insert a block in order, dropping blocks it covers.
+  * @param  id first identifier, aligned to the size
+  * @param  bits log2 of the size
+  * @param  cls class
+  * @retval None
+  */
+static void add_block(uint32_t id, uint32_t bits, uint32_t cls)
+{
+  block_t block = { id, (uint8_t)bits, (uint8_t)cls };
+  uint32_t pos = 0U;
+
+  while ((pos < block_count) &&
+         ((blocks[pos].cls < cls) || ((blocks[pos].cls == cls) && (blocks[pos].id < id))))
+  {
+    pos++;
+  }
+
+  /* inside a block already there, ranges overlap */
+  if ((pos > 0U) && (blocks[pos - 1U].cls == cls) && (id < block_end(&blocks[pos - 1U])))
+  {
+    return;
+  }
+  if ((pos < block_count) && (blocks[pos].cls == cls) && (blocks[pos].id == id) && (blocks[pos].bits >= bits))
+  {
+    return;
+  }
+
+  uint32_t end = pos;
+  while ((end < block_count) && (blocks[end].cls == cls) && (blocks[end].id < block_end(&block)))
+  {
+    end++;
+  }
+
+  if ((end == pos) && (block_count == CAN_FILTER_MAX_BLOCKS))
+  {
+    /* make room, then find the place again */
+    merge_cheapest();
+    add_block(id, bits, cls);
+    return;
+  }
+
+  if (end == pos)
+  {
+    for (uint32_t j = block_count; j > pos; j--)
+    {
+      blocks[j] = blocks[j - 1U];
+    }
+    block_count++;
+  }
+  else
+  {
+    for (uint32_t j = end; j < block_count; j++)
+    {
+      blocks[pos + 1U + (j - end)] = blocks[j];
+    }
+    block_count -= end - pos - 1U;
+  }
+  blocks[pos] = block;
+}
+
+/**
+  * @brief  Split a range into aligned power of two blocks.
+  * @param  range identifiers and class
+  * @retval None
+  */
+static void add_range(const can_filter_range_t *range)
+{
+  uint32_t cls = range->flags & (CAN_RANGE_EXT | CAN_RANGE_RTR | CAN_RANGE_FIFO1);
+  uint32_t width = id_bits(cls);
+  uint32_t id = range->first;
+
+  for (;;)
+  {
+    uint32_t bits = 0U;
+
+    while ((bits < width) && ((id & ((2UL << bits) - 1U)) == 0U) && ((range->last - id) >= ((2UL << bits) - 1U)))
+    {
+      bits++;
+    }
+    add_block(id, bits, cls);
+
+    if ((range->last - id) < (1UL << bits))
+    {
+      return;
+    }
+    id += 1UL << bits;
+  }
+}
+
+/**
+  * @brief  Count the requested identifiers first to last.
+  * @param  ranges accepted identifiers, may overlap
+  * @param  count number of ranges
+  * @param  cls class the ranges must have in the bits of mask
+  * @param  mask class bits compared
+  * @param  first first identifier
+  * @param  last last identifier
+  * @retval identifiers in the union of the matching ranges
+  */
+static uint32_t requested(const can_filter_range_t *ranges, uint32_t count, uint32_t cls, uint32_t mask,
+                          uint32_t first, uint32_t last)
+{
+  uint32_t total = 0U;
+  uint32_t id = first;
+
+  for (;;)
+  {
+    bool inside = false;
+    bool ahead = false;
+    uint32_t reach = 0U;
+    uint32_t next = last;
+
+    for (uint32_t i = 0U; i < count; i++)
+    {
+      if ((ranges[i].flags & mask) != cls)
+      {
+        continue;
+      }
+      if ((ranges[i].first <= id) && (ranges[i].last >= id))
+      {
+        inside = true;
+        reach = (ranges[i].last > reach) ? ranges[i].last : reach;
+      }
+      else if ((ranges[i].first > id) && (ranges[i].first <= next))
+      {
+        ahead = true;
+        next = ranges[i].first;
+      }
+    }
+
+    if (inside)
+    {
+      uint32_t stop = (reach < last) ? reach : last;
+
+      total += stop - id + 1U;
+      if (stop == last)
+      {
+        return total;
+      }
+      id = stop + 1U;
+    }
+    else if (ahead)
+    {
+      id = next;
+    }
+    else
+    {
+      return total;
+    }
+  }
+}
+
+static uint32_t frames(const block_t *block)
+{
+  return ((block->cls & CAN_RANGE_RTR) != 0U) ? CAN_FILTER_REMOTE : CAN_FILTER_DATA;
+}
+
+static uint32_t std_value(const block_t *block)
+{
+  return CAN_FILTER_STD_WORD(block->id, frames(block));
+}
+
+static uint32_t std_mask(const block_t *block)
+{
+  return CAN_FILTER_STD_MASK(block->id, block_end(block) - 1U, frames(block));
+}
+
+static uint32_t ext_value(const block_t *block)
+{
+  return CAN_FILTER_EXT_WORD(block->id, frames(block));
+}
+
+static uint32_t ext_mask(const block_t *block)
+{
+  return CAN_FILTER_EXT_MASK(block->id, block_end(block) - 1U, frames(block));
+}
+
+/**
+  * @brief  Fill the banks of one class.
+  * @param  cls class
+  * @param  table destination, count advanced
+  * @retval None
+  */
+static void emit_class(uint32_t cls, can_filter_table_t *table)
+{
+  const block_t *singles[CAN_FILTER_MAX_BLOCKS];
+  const block_t *masks[CAN_FILTER_MAX_BLOCKS];
+  uint32_t s = 0U;
+  uint32_t m = 0U;
+  uint8_t fifo = ((cls & CAN_RANGE_FIFO1) != 0U) ? CAN_FILTER_FIFO1 : CAN_FILTER_FIFO0;
+
+  for (uint32_t i = 0U; i < block_count; i++)
+  {
+    if (blocks[i].cls == cls)
+    {
+      if (blocks[i].bits == 0U)
+      {
+        singles[s++] = &blocks[i];
+      }
+      else
+      {
+        masks[m++] = &blocks[i];
+      }
+    }
+  }
+
+  if ((cls & CAN_RANGE_EXT) != 0U)
+  {
+    for (uint32_t i = 0U; i < s; i += 2U)
+    {
+      can_filter_bank_t *bank = &table->banks[table->count++];
+
+      bank->fr1 = ext_value(singles[i]);
+      bank->fr2 = ext_value(singles[(i + 1U < s) ? (i + 1U) : i]);
+      bank->list = 1U;
+      bank->wide = 1U;
+      bank->fifo = fifo;
+    }
+    for (uint32_t i = 0U; i < m; i++)
+    {
+      can_filter_bank_t *bank = &table->banks[table->count++];
+
+      bank->fr1 = ext_value(masks[i]);
+      bank->fr2 = ext_mask(masks[i]);
+      bank->list = 0U;
+      bank->wide = 1U;
+      bank->fifo = fifo;
+    }
+    return;
+  }
+
+  /* a lone single fills the spare half of the last mask bank */
+  if (((s % 4U) == 1U) && ((m % 2U) == 1U))
+  {
+    masks[m++] = singles[--s];
+  }
+
+  for (uint32_t i = 0U; i < s; i += 4U)
+  {
+    can_filter_bank_t *bank = &table->banks[table->count++];
+    uint32_t ids[4];
+
+    for (uint32_t k = 0U; k < 4U; k++)
+    {
+      ids[k] = std_value(singles[(i + k < s) ? (i + k) : i]);
+    }
+    bank->fr1 = ids[0] | (ids[1] << 16);
+    bank->fr2 = ids[2] | (ids[3] << 16);
+    bank->list = 1U;
+    bank->wide = 0U;
+    bank->fifo = fifo;
+  }
+  for (uint32_t i = 0U; i < m; i += 2U)
+  {
+    can_filter_bank_t *bank = &table->banks[table->count++];
+    const block_t *second = masks[(i + 1U < m) ? (i + 1U) : i];
+
+    bank->fr1 = std_value(masks[i]) | (std_mask(masks[i]) << 16);
+    bank->fr2 = std_value(second) | (std_mask(second) << 16);
+    bank->list = 0U;
+    bank->wide = 0U;
+    bank->fifo = fifo;
+  }
+}
+
+/**
+  * @brief  Pack a set of identifiers and ranges into filter banks.
+  * @note   Not reentrant, uses a static work area.
+  * @param  ranges accepted identifiers
+  * @param  count number of ranges, 0 accepts nothing
+  * @param  max_banks banks available, 1 to CAN_FILTER_BANKS
+  * @param  table filled with the banks and the expected false accepts
+  * @retval false if a range is out of bounds
+  */
+bool can_filter_compile(const can_filter_range_t *ranges, uint32_t count, uint32_t max_banks,
+                        can_filter_table_t *table)
+{
+  const uint32_t class_mask = CAN_RANGE_EXT | CAN_RANGE_RTR | CAN_RANGE_FIFO1;
+
+  if ((max_banks == 0U) || (max_banks > CAN_FILTER_BANKS))
+  {
+    return false;
+  }
+  for (uint32_t i = 0U; i < count; i++)
+  {
+    uint32_t limit = ((ranges[i].flags & CAN_RANGE_EXT) != 0U) ? 0x1FFFFFFFU : 0x7FFU;
+
+    if ((ranges[i].first > ranges[i].last) || (ranges[i].last > limit))
+    {
+      return false;
+    }
+  }
+
+  block_count = 0U;
+  for (uint32_t i = 0U; i < count; i++)
+  {
+    add_range(&ranges[i]);
+  }
+  while ((total_banks() > max_banks) && merge_cheapest())
+  {
+  }
+
+  table->count = 0U;
+  table->false_accepts = 0U;
+
+  if (total_banks() > max_banks)
+  {
+    /* more classes than banks: one 32 bit mask of all zeros */
+    can_filter_bank_t *bank = &table->banks[table->count++];
+
+    bank->fr1 = 0U;
+    bank->fr2 = 0U;
+    bank->list = 0U;
+    bank->wide = 1U;
+    bank->fifo = CAN_FILTER_FIFO0;
+
+    /* both frame formats, data and remote, whatever FIFO was asked for */
+    table->false_accepts = 2U * (0x800U + 0x20000000U);
+    for (uint32_t cls = 0U; cls < CAN_RANGE_FIFO1; cls++)
+    {
+      uint32_t last = ((cls & CAN_RANGE_EXT) != 0U) ? 0x1FFFFFFFU : 0x7FFU;
+
+      table->false_accepts -= requested(ranges, count, cls, CAN_RANGE_EXT | CAN_RANGE_RTR, 0U, last);
+    }
+    return true;
+  }
+
+  for (uint32_t i = 0U; i < block_count; i++)
+  {
+    uint32_t last = block_end(&blocks[i]) - 1U;
+
+    table->false_accepts += (last - blocks[i].id + 1U) -
+                            requested(ranges, count, blocks[i].cls, class_mask, blocks[i].id, last);
+  }
+  for (uint32_t cls = 0U; cls < CLASSES; cls++)
+  {
+    emit_class(cls, table);
+  }
+  return true;
+}
+
+/*
+ * The configuration table, one bank per entry. Every entry expands once
+ * into its register words and once into the checks that keep impossible
+ * entries from building.
+ */
+#define STD_LIST_BANK(fifo, frames, a, b, c, d)                                  \
+  { CAN_FILTER_STD_WORD(a, frames) | (CAN_FILTER_STD_WORD(b, frames) << 16),      \
+    CAN_FILTER_STD_WORD(c, frames) | (CAN_FILTER_STD_WORD(d, frames) << 16), 1U, 0U, (fifo) },
+#define STD_BLOCKS_BANK(fifo, frames, first1, last1, first2, last2)                              \
+  { CAN_FILTER_STD_WORD(first1, frames) | (CAN_FILTER_STD_MASK(first1, last1, frames) << 16),   \
+    CAN_FILTER_STD_WORD(first2, frames) | (CAN_FILTER_STD_MASK(first2, last2, frames) << 16), 0U, 0U, (fifo) },
+#define EXT_LIST_BANK(fifo, frames, a, b) \
+  { CAN_FILTER_EXT_WORD(a, frames), CAN_FILTER_EXT_WORD(b, frames), 1U, 1U, (fifo) },
+#define EXT_BLOCK_BANK(fifo, frames, first, last) \
+  { CAN_FILTER_EXT_WORD(first, frames), CAN_FILTER_EXT_MASK(first, last, frames), 0U, 1U, (fifo) },
+
+static const can_filter_bank_t config_banks[] =
+{
+  CAN_FILTER_CONFIG_TABLE(STD_LIST_BANK, STD_BLOCKS_BANK, EXT_LIST_BANK, EXT_BLOCK_BANK)
+};
+
+#define CHECK_FIFO(fifo) \
+  _Static_assert(((fifo) == CAN_FILTER_FIFO0) || ((fifo) == CAN_FILTER_FIFO1), "filter FIFO must be 0 or 1");
+#define CHECK_LIST_ID(id, max, frames)                                                       \
+  _Static_assert((id) <= (max), "filter list identifier out of range");                     \
+  _Static_assert(((frames) == CAN_FILTER_DATA) || ((frames) == CAN_FILTER_REMOTE),          \
+                 "filter lists take CAN_FILTER_DATA or CAN_FILTER_REMOTE");
+#define CHECK_BLOCK(first, last, max, frames)                                                \
+  _Static_assert(CAN_FILTER_IS_BLOCK(first, last, max),                                     \
+                 "filter block must be a power of two identifiers aligned to its size");    \
+  _Static_assert((frames) <= CAN_FILTER_ANY, "filter frames out of range");
+
+#define STD_LIST_CHECK(fifo, frames, a, b, c, d) \
+  CHECK_FIFO(fifo) CHECK_LIST_ID(a, 0x7FFU, frames) CHECK_LIST_ID(b, 0x7FFU, frames) \
+  CHECK_LIST_ID(c, 0x7FFU, frames) CHECK_LIST_ID(d, 0x7FFU, frames)
+#define STD_BLOCKS_CHECK(fifo, frames, first1, last1, first2, last2) \
+  CHECK_FIFO(fifo) CHECK_BLOCK(first1, last1, 0x7FFU, frames) CHECK_BLOCK(first2, last2, 0x7FFU, frames)
+#define EXT_LIST_CHECK(fifo, frames, a, b) \
+  CHECK_FIFO(fifo) CHECK_LIST_ID(a, 0x1FFFFFFFU, frames) CHECK_LIST_ID(b, 0x1FFFFFFFU, frames)
+#define EXT_BLOCK_CHECK(fifo, frames, first, last) \
+  CHECK_FIFO(fifo) CHECK_BLOCK(first, last, 0x1FFFFFFFU, frames)
+
+CAN_FILTER_CONFIG_TABLE(STD_LIST_CHECK, STD_BLOCKS_CHECK, EXT_LIST_CHECK, EXT_BLOCK_CHECK)
+
+_Static_assert(sizeof(config_banks) / sizeof(config_banks[0]) <= CAN_FILTER_BANKS,
+               "filter configuration needs more than 14 banks");
+
+/**
+  * @brief  Write banks in one go and switch off the others.
+  * @note   Reception pauses for the few register writes between setting
+  *         and clearing FINIT instead of once per bank.
+  * @param  can CAN instance
+  * @param  banks register words, bank 0 first
+  * @param  count number of banks, up to CAN_FILTER_BANKS
+  * @retval None
+  */
+void can_filter_write(CAN_TypeDef *can, const can_filter_bank_t *banks, uint32_t count)
+{
+  uint32_t fm1r = 0U;
+  uint32_t fs1r = 0U;
+  uint32_t ffa1r = 0U;
+
+  for (uint32_t i = 0U; i < count; i++)
+  {
+    fm1r |= (uint32_t)banks[i].list << i;
+    fs1r |= (uint32_t)banks[i].wide << i;
+    ffa1r |= (uint32_t)banks[i].fifo << i;
+  }
+
+  SET_BIT(can->FMR, CAN_FMR_FINIT);
+  can->FA1R = 0U;
+  can->FM1R = fm1r;
+  can->FS1R = fs1r;
+  can->FFA1R = ffa1r;
+  for (uint32_t i = 0U; i < count; i++)
+  {
+    can->sFilterRegister[i].FR1 = banks[i].fr1;
+    can->sFilterRegister[i].FR2 = banks[i].fr2;
+  }
+  can->FA1R = (1UL << count) - 1U;
+  CLEAR_BIT(can->FMR, CAN_FMR_FINIT);
+}
+
+/**
+  * @brief  can_filter_write in the states HAL_CAN_ConfigFilter accepts.
+  * @param  hcan pointer to the CAN handle
+  * @param  banks register words, bank 0 first
+  * @param  count number of banks
+  * @retval HAL status
+  */
+static HAL_StatusTypeDef write_banks(CAN_HandleTypeDef *hcan, const can_filter_bank_t *banks, uint32_t count)
+{
+  if ((hcan->State != HAL_CAN_STATE_READY) && (hcan->State != HAL_CAN_STATE_LISTENING))
+  {
+    hcan->ErrorCode |= HAL_CAN_ERROR_NOT_INITIALIZED;
+    return HAL_ERROR;
+  }
+
+  can_filter_write(hcan->Instance, banks, count);
+  return HAL_OK;
+}
+
+/**
+  * @brief  Write a compiled table to the first banks and switch off the rest.
+  * @note   Works before and after HAL_CAN_Start like HAL_CAN_ConfigFilter.
+  * @param  hcan pointer to the CAN handle
+  * @param  table banks from can_filter_compile
+  * @retval HAL status
+  */
+HAL_StatusTypeDef can_filter_apply(CAN_HandleTypeDef *hcan, const can_filter_table_t *table)
+{
+  return write_banks(hcan, table->banks, table->count);
+}
+
+/**
+  * @brief  Write the banks of can_filter_config.h.
+  * @param  hcan pointer to the CAN handle
+  * @retval HAL status
+  */
+HAL_StatusTypeDef can_filter_apply_config(CAN_HandleTypeDef *hcan)
+{
+  return write_banks(hcan, config_banks, sizeof(config_banks) / sizeof(config_banks[0]));
+}
+
+/*
+ * Hitless switch. FR1/FR2 of an inactive bank can be written at any time,
+ * only the mode, scale and FIFO bits need FINIT, which also stops the
+ * filters from accepting frames. The new table therefore goes into banks
+ * that are not in use, FINIT is held just for the three mode registers
+ * (and not at all if those banks already have the right modes), and a
+ * single FA1R store turns the new banks on and the old ones off. Every
+ * frame is matched against either the old or the new set, never a mix.
+ */
+#define BANK_MASK ((1UL << CAN_FILTER_BANKS) - 1U)
+
+/**
+  * @brief  Number of filter banks not in use, the largest table
+  *         can_filter_swap switches to without a gap.
+  * @param  hcan pointer to the CAN handle
+  * @retval inactive banks
+  */
+uint32_t can_filter_spare(const CAN_HandleTypeDef *hcan)
+{
+  uint32_t spare = ~hcan->Instance->FA1R & BANK_MASK;
+  uint32_t count = 0U;
+
+  while (spare != 0U)
+  {
+    spare &= spare - 1U;
+    count++;
+  }
+  return count;
+}
+
+/**
+  * @brief  Replace the active filters by a table while the bus runs.
+  * @note   If fewer banks than the table needs are free, it is written
+  *         in place with can_filter_write instead and swap->hitless is
+  *         cleared. Interrupts are off while FINIT is set.
+  * @param  hcan pointer to the CAN handle
+  * @param  table banks from can_filter_compile
+  * @param  swap set to how the switch went
+  * @retval HAL status
+  */
+HAL_StatusTypeDef can_filter_swap(CAN_HandleTypeDef *hcan, const can_filter_table_t *table, can_filter_swap_t *swap)
+{
+  CAN_TypeDef *can = hcan->Instance;
+
+  if ((hcan->State != HAL_CAN_STATE_READY) && (hcan->State != HAL_CAN_STATE_LISTENING))
+  {
+    hcan->ErrorCode |= HAL_CAN_ERROR_NOT_INITIALIZED;
+    return HAL_ERROR;
+  }
+
+  swap->gap_cycles = 0U;
+  swap->hitless = table->count <= can_filter_spare(hcan);
+
+  if (!swap->hitless)
+  {
+    __disable_irq();
+    uint32_t start = DWT->CYCCNT;
+    can_filter_write(can, table->banks, table->count);
+    swap->gap_cycles = DWT->CYCCNT - start;
+    __enable_irq();
+    return HAL_OK;
+  }
+
+  uint32_t spare = ~can->FA1R & BANK_MASK;
+  uint32_t target = 0U;
+  uint32_t fm1r = 0U;
+  uint32_t fs1r = 0U;
+  uint32_t ffa1r = 0U;
+  uint32_t bank = 0U;
+
+  for (uint32_t i = 0U; i < table->count; i++)
+  {
+    while ((spare & (1UL << bank)) == 0U)
+    {
+      bank++;
+    }
+
+    /* inactive, writable without FINIT */
+    can->sFilterRegister[bank].FR1 = table->banks[i].fr1;
+    can->sFilterRegister[bank].FR2 = table->banks[i].fr2;
+    fm1r |= (uint32_t)table->banks[i].list << bank;
+    fs1r |= (uint32_t)table->banks[i].wide << bank;
+    ffa1r |= (uint32_t)table->banks[i].fifo << bank;
+    target |= 1UL << bank;
+    bank++;
+  }
+
+  if (((can->FM1R & target) != fm1r) || ((can->FS1R & target) != fs1r) || ((can->FFA1R & target) != ffa1r))
+  {
+    __disable_irq();
+    uint32_t start = DWT->CYCCNT;
+    SET_BIT(can->FMR, CAN_FMR_FINIT);
+    can->FM1R = (can->FM1R & ~target) | fm1r;
+    can->FS1R = (can->FS1R & ~target) | fs1r;
+    can->FFA1R = (can->FFA1R & ~target) | ffa1r;
+    CLEAR_BIT(can->FMR, CAN_FMR_FINIT);
+    swap->gap_cycles = DWT->CYCCNT - start;
+    __enable_irq();
+  }
+
+  can->FA1R = target;
+  return HAL_OK;
+}
@@ -0,0 +1,338 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "can_load.h"
+#include "can_tx.h"
+#include "can_time.h"
+#include "timestamp.h"
+
+/*
+ * Bus load generator. The main loop tops up the TX queue with synthetic
+ * frames, paced by a credit of bus bits that grows with the target share
+ * of the nominal bit rate. A frame is queued once the credit covers its
+ * length, so the long-run load follows the target whatever mix of
+ * identifiers and DLCs is drawn. At 100 % the credit never runs short and
+ * the queue simply stays full.
+ *
+ * Frame lengths are exact: the stream from SOF to the CRC is built bit by
+ * bit with its CRC-15 and stuff bits, plus the fixed tail (CRC delimiter,
+ * ACK, EOF, 3 bit interframe space). The length rides along in the can_tx
+ * tag, so the done callback adds up the bits that really went out and
+ * the reported utilisation is measured, not estimated.
+ *
+ * Identifiers, DLCs and payload bytes come from one xorshift32 generator.
+ */
+
+/* CRC delimiter, ACK slot and delimiter, EOF, interframe space */
+#define FRAME_TAIL_BITS (1U + 2U + 7U + 3U)
+
+/* credit cap in bits, bounds the burst after the main loop stalled */
+#define CREDIT_MAX_BITS (CAN_TX_QUEUE_SIZE * 160U)
+
+#define TAG_BITS_MASK 0xFFFFU
+
+typedef struct
+{
+  uint32_t count;
+  uint32_t run;
+  uint32_t last;
+  uint32_t stuffed;
+  uint32_t crc;
+} bit_stream_t;
+
+static uint32_t bit_ns;
+static can_load_config_t config;
+static uint32_t dlc_cumulative[9];
+static uint32_t prng;
+static uint32_t next_id;
+static can_frame_t next;
+static uint32_t next_bits;
+static uint64_t credit_mbits; /* 1/1000 bit */
+static uint32_t last_us;
+static volatile bool running;
+static uint64_t start_us;
+static uint64_t stop_us;
+static volatile uint32_t frames;
+static volatile uint32_t failed;
+static volatile uint64_t bits;
+
+/**
+  * @brief  Append bits to a frame, updating CRC and stuffing.
+  * @param  stream bit stream state
+  * @param  value bits, most significant first
+  * @param  n number of bits
+  * @param  crc true while the bits are covered by the CRC
+  * @retval None
+  */
+static void put_bits(bit_stream_t *stream, uint32_t value, uint32_t n, bool crc)
+{
+  while (n > 0U)
+  {
+    n--;
+    uint32_t bit = (value >> n) & 1U;
+
+    if (crc)
+    {
+      uint32_t feedback = bit ^ ((stream->crc >> 14) & 1U);
+      stream->crc = (stream->crc << 1) & 0x7FFFU;
+      if (feedback != 0U)
+      {
+        stream->crc ^= 0x4599U;
+      }
+    }
+
+    stream->count++;
+    if ((stream->count > 1U) && (bit == stream->last))
+    {
+      stream->run++;
+    }
+    else
+    {
+      stream->run = 1U;
+    }
+    stream->last = bit;
+
+    if (stream->run == 5U)
+    {
+      /* the complement bit starts the next run */
+      stream->stuffed++;
+      stream->last = bit ^ 1U;
+      stream->run = 1U;
+    }
+  }
+}
+
+/**
+  * @brief  Length of a frame on the bus.
+  * @param  frame frame in mailbox layout
+  * @retval bits from SOF to the end of the interframe space, stuff bits included
+  */
+uint32_t can_load_frame_bits(const can_frame_t *frame)
+{
+  bit_stream_t stream = {0};
+  uint32_t id = can_frame_id(frame);
+  uint32_t rtr = can_frame_is_rtr(frame) ? 1U : 0U;
+  uint32_t dlc = frame->rdtr & CAN_TDT0R_DLC;
+  uint32_t length = rtr ? 0U : can_frame_dlc(frame);
+  const uint8_t *data = can_frame_data(frame);
+
+  put_bits(&stream, 0U, 1U, true);
+  if (can_frame_is_ext(frame))
+  {
+    put_bits(&stream, id >> 18, 11U, true);
+    put_bits(&stream, 0x3U, 2U, true);     /* SRR, IDE */
+    put_bits(&stream, id, 18U, true);
+    put_bits(&stream, rtr, 1U, true);
+    put_bits(&stream, 0U, 2U, true);       /* r1, r0 */
+  }
+  else
+  {
+    put_bits(&stream, id, 11U, true);
+    put_bits(&stream, rtr, 1U, true);
+    put_bits(&stream, 0U, 2U, true);       /* IDE, r0 */
+  }
+  put_bits(&stream, dlc, 4U, true);
+  for (uint32_t i = 0U; i < length; i++)
+  {
+    put_bits(&stream, data[i], 8U, true);
+  }
+  put_bits(&stream, stream.crc, 15U, false);
+
+  return stream.count + stream.stuffed + FRAME_TAIL_BITS;
+}
+
+static uint32_t random32(void)
+{
+  prng ^= prng << 13;
+  prng ^= prng >> 17;
+  prng ^= prng << 5;
+  return prng;
+}
+
+/**
+  * @brief  Draw the next frame and its length.
+  * @retval None
+  */
+static void generate(void)
+{
+  uint32_t span = config.id_max - config.id_min + 1U;
+  uint32_t id;
+  uint32_t dlc = 0U;
+
+  if ((config.flags & CAN_LOAD_SEQUENTIAL) != 0U)
+  {
+    id = next_id;
+    next_id = (next_id == config.id_max) ? config.id_min : next_id + 1U;
+  }
+  else
+  {
+    id = config.id_min + ((span != 0U) ? (random32() % span) : random32());
+  }
+
+  uint32_t pick = random32() % dlc_cumulative[8];
+  while (pick >= dlc_cumulative[dlc])
+  {
+    dlc++;
+  }
+
+  can_frame_set_header(&next, id, (config.flags & CAN_LOAD_EXT) != 0U, false, dlc);
+  next.data[0] = random32();
+  next.data[1] = random32();
+  next_bits = can_load_frame_bits(&next);
+}
+
+/**
+  * @brief  Take the bit rate from the CAN configuration.
+  * @param  hcan CAN handle, started by the caller
+  * @retval None
+  */
+void can_load_init(CAN_HandleTypeDef *hcan)
+{
+  bit_ns = can_time_bit_ns(hcan->Instance);
+}
+
+/**
+  * @brief  Reset the statistics and start generating.
+  * @param  cfg target load, identifiers, DLC mix and seed
+  * @retval false if the configuration is out of range
+  */
+bool can_load_start(const can_load_config_t *cfg)
+{
+  uint32_t id_limit = ((cfg->flags & CAN_LOAD_EXT) != 0U) ? 0x1FFFFFFFU : 0x7FFU;
+  uint32_t total = 0U;
+
+  if ((cfg->load_percent == 0U) || (cfg->load_percent > 100U) ||
+      (cfg->id_min > cfg->id_max) || (cfg->id_max > id_limit))
+  {
+    return false;
+  }
+
+  can_load_stop();
+
+  config = *cfg;
+  for (uint32_t dlc = 0U; dlc <= 8U; dlc++)
+  {
+    total += config.dlc_weights[dlc];
+    dlc_cumulative[dlc] = total;
+  }
+  if (total == 0U)
+  {
+    dlc_cumulative[8] = 1U;
+  }
+
+  prng = (config.seed != 0U) ? config.seed : 0x2545F491U;
+  next_id = config.id_min;
+  generate();
+
+  __disable_irq();
+  frames = 0U;
+  failed = 0U;
+  bits = 0U;
+  __enable_irq();
+
+  credit_mbits = 0U;
+  start_us = timestamp_now_us();
+  last_us = (uint32_t)start_us;
+  running = true;
+  return true;
+}
+
+/**
+  * @brief  Stop generating. Frames already queued still go out and count.
+  * @retval None
+  */
+void can_load_stop(void)
+{
+  if (running)
+  {
+    running = false;
+    stop_us = timestamp_now_us();
+  }
+}
+
+bool can_load_running(void)
+{
+  return running;
+}
+
+/**
+  * @brief  Queue generated frames the credit allows. Call from the main loop.
+  * @retval None
+  */
+void can_load_poll(void)
+{
+  if (!running)
+  {
+    return;
+  }
+
+  uint32_t now = (uint32_t)timestamp_now_us();
+  uint64_t bit_rate = 1000000000U / bit_ns;
+
+  /* elapsed us * bits per us * share, in 1/1000 bit */
+  credit_mbits += ((uint64_t)(now - last_us) * bit_rate * config.load_percent) / 100000U;
+  last_us = now;
+  if (credit_mbits > (CREDIT_MAX_BITS * 1000U))
+  {
+    credit_mbits = CREDIT_MAX_BITS * 1000U;
+  }
+
+  while ((can_tx_free() > CAN_LOAD_RESERVE) && (credit_mbits >= (next_bits * 1000U)))
+  {
+    if (!can_tx_queue(&next, CAN_LOAD_TAG | next_bits, CAN_TX_NO_DEADLINE))
+    {
+      break;
+    }
+    credit_mbits -= next_bits * 1000U;
+    generate();
+  }
+}
+
+/**
+  * @brief  Account a finished frame. Called from the can_tx done callback.
+  * @param  tag CAN_LOAD_TAG and frame length
+  * @param  status CAN_TX_SENT or the reason it was not sent
+  * @param  time_us unused
+  * @retval None
+  */
+void can_load_done(uint32_t tag, uint32_t status, uint64_t time_us)
+{
+  (void)time_us;
+
+  if (status == CAN_TX_SENT)
+  {
+    frames++;
+    bits += tag & TAG_BITS_MASK;
+  }
+  else
+  {
+    failed++;
+  }
+}
+
+/**
+  * @brief  Traffic achieved since the last start, up to now or the stop.
+  * @param  stats filled in
+  * @retval None
+  */
+void can_load_stats(can_load_stats_t *stats)
+{
+  uint64_t end = running ? timestamp_now_us() : stop_us;
+
+  __disable_irq();
+  stats->frames = frames;
+  stats->failed = failed;
+  stats->bits = bits;
+  __enable_irq();
+
+  stats->elapsed_us = end - start_us;
+  stats->frames_per_s = 0U;
+  stats->load_permille = 0U;
+  if (stats->elapsed_us != 0U)
+  {
+    stats->frames_per_s = (uint32_t)(((uint64_t)stats->frames * 1000000U) / stats->elapsed_us);
+    /* bits * bit time / elapsed time, ns over us gives permille */
+    stats->load_permille = (uint32_t)((stats->bits * bit_ns) / stats->elapsed_us);
+  }
+}
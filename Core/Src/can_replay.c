@@ -0,0 +1,401 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "can_replay.h"
+#include "can_tx.h"
+#include "timestamp.h"
+
+/*
+ * Device timed trace replay driven by output compare channel 2 of the
+ * timestamp timer. The host streams records of trace time and frame into
+ * a ring and keeps refilling it while the trace plays. The compare
+ * interrupt hands every record to can_tx_queue once its time has come and
+ * re-arms the compare for the next one, so USB and host scheduling only
+ * have to keep the ring from running dry, not hit the frame times.
+ *
+ * Trace times are relative, the first record buffered after a stop plays
+ * at the start time. The scheduling error of a frame is its start of frame
+ * from the mailbox TIME field minus the time it was due. Due times of
+ * frames in flight are kept by frame number until can_tx reports them,
+ * can_tx never holds more frames than fit that window.
+ *
+ * A record that reaches an empty ring after its time has passed is an
+ * underrun, the host did not refill in time. Playback keeps the original
+ * timeline, such frames go out at once and show up with their error.
+ */
+typedef struct
+{
+  uint32_t rir;
+  uint32_t rdtr;
+  uint32_t data[2];
+  uint32_t time_us;
+} replay_record_t;
+
+/* delay before a release the TX queue refused is tried again */
+#define QUEUE_RETRY_US 20U
+
+_Static_assert((CAN_REPLAY_BUFFER & (CAN_REPLAY_BUFFER - 1U)) == 0U, "CAN_REPLAY_BUFFER must be a power of two");
+_Static_assert((CAN_REPLAY_RESULTS & (CAN_REPLAY_RESULTS - 1U)) == 0U, "CAN_REPLAY_RESULTS must be a power of two");
+_Static_assert(CAN_REPLAY_BUFFER > CAN_TX_QUEUE_SIZE + 3U, "due times of frames in flight would be overwritten");
+
+static TIM_HandleTypeDef *timer;
+
+/* written by the main loop (head) and the compare interrupt (tail) */
+static replay_record_t ring[CAN_REPLAY_BUFFER];
+static volatile uint32_t ring_head;
+static volatile uint32_t ring_tail;
+static uint32_t last_time_us;
+static bool have_base;
+static uint32_t base_us;
+
+static volatile bool running;
+static volatile bool ended;
+static volatile bool starved;
+static uint32_t start_us;
+static uint32_t next_index;
+static uint32_t due_us[CAN_REPLAY_BUFFER];
+
+static volatile uint32_t released;
+static volatile uint32_t sent;
+static volatile uint32_t failed;
+static volatile uint32_t underruns;
+static int32_t min_error_us;
+static int32_t max_error_us;
+static int64_t error_sum_us;
+
+/* written by the CAN TX interrupt (head) and the main loop (tail) */
+static can_replay_result_t results[CAN_REPLAY_RESULTS];
+static volatile uint32_t results_head;
+static volatile uint32_t results_tail;
+static volatile uint32_t results_lost;
+
+/**
+  * @brief  Stop the compare interrupt, playback is over.
+  * @retval None
+  */
+static void finish(void)
+{
+  __HAL_TIM_DISABLE_IT(timer, TIM_IT_CC2);
+  running = false;
+}
+
+/**
+  * @brief  Release all due records and arm the compare for the next one.
+  * @note   Runs from the timer interrupt or with interrupts disabled.
+  * @retval None
+  */
+static void service(void)
+{
+  for (;;)
+  {
+    uint32_t tail = ring_tail;
+    uint32_t now = (uint32_t)timestamp_now_us();
+    uint32_t due;
+
+    if (tail == ring_head)
+    {
+      if (ended)
+      {
+        finish();
+      }
+      starved = true;
+      return;
+    }
+
+    const replay_record_t *record = &ring[tail & (CAN_REPLAY_BUFFER - 1U)];
+    due = start_us + (record->time_us - base_us);
+
+    if (starved)
+    {
+      starved = false;
+      if ((int32_t)(due - now) < 0)
+      {
+        underruns++;
+      }
+    }
+
+    if ((int32_t)(due - now) > 0)
+    {
+      __HAL_TIM_SET_COMPARE(timer, TIM_CHANNEL_2, due & 0xFFFFU);
+
+      /* done unless the due time passed while the compare was written */
+      if ((int32_t)(due - (uint32_t)timestamp_now_us()) > 0)
+      {
+        return;
+      }
+      continue;
+    }
+
+    can_frame_t frame;
+
+    frame.rir = record->rir;
+    frame.rdtr = record->rdtr;
+    frame.data[0] = record->data[0];
+    frame.data[1] = record->data[1];
+    if (!can_tx_queue(&frame, CAN_REPLAY_TAG | (next_index & 0xFFFFU), CAN_TX_NO_DEADLINE))
+    {
+      __HAL_TIM_SET_COMPARE(timer, TIM_CHANNEL_2, (now + QUEUE_RETRY_US) & 0xFFFFU);
+      return;
+    }
+
+    due_us[next_index & (CAN_REPLAY_BUFFER - 1U)] = due;
+    next_index++;
+    released++;
+    __DMB();
+    ring_tail = tail + 1U;
+  }
+}
+
+/**
+  * @brief  Compare match of channel 2.
+  * @retval None
+  */
+static void compare(void)
+{
+  if (running)
+  {
+    service();
+  }
+}
+
+/**
+  * @brief  Attach the timer, call after timestamp_start.
+  * @param  htim timestamp timer, channel 2 set up as output compare without output
+  * @retval None
+  */
+void can_replay_init(TIM_HandleTypeDef *htim)
+{
+  timer = htim;
+  timestamp_set_compare_callback(TIM_CHANNEL_2, compare);
+}
+
+/**
+  * @brief  Buffer a trace record, before or during playback.
+  * @param  frame record with rir in TIR layout
+  * @param  time_us trace time, not earlier than the previous record
+  * @retval false if the buffer is full or the time runs backwards
+  */
+bool can_replay_push(const can_frame_t *frame, uint32_t time_us)
+{
+  uint32_t head = ring_head;
+
+  if ((head - ring_tail) >= CAN_REPLAY_BUFFER)
+  {
+    return false;
+  }
+  if (!have_base)
+  {
+    have_base = true;
+    base_us = time_us;
+    last_time_us = time_us;
+  }
+  if ((int32_t)(time_us - last_time_us) < 0)
+  {
+    return false;
+  }
+
+  replay_record_t *record = &ring[head & (CAN_REPLAY_BUFFER - 1U)];
+
+  record->rir = frame->rir;
+  record->rdtr = frame->rdtr;
+  record->data[0] = frame->data[0];
+  record->data[1] = frame->data[1];
+  record->time_us = time_us;
+  last_time_us = time_us;
+  __DMB();
+  ring_head = head + 1U;
+
+  /* a starved playback waits for the next compare, catch up right away */
+  if (running && starved)
+  {
+    __disable_irq();
+    if (running)
+    {
+      service();
+    }
+    __enable_irq();
+  }
+  return true;
+}
+
+/**
+  * @brief  No more records follow, playback stops once the buffer is empty.
+  * @retval None
+  */
+void can_replay_end(void)
+{
+  ended = true;
+
+  __disable_irq();
+  if (running && starved)
+  {
+    finish();
+  }
+  __enable_irq();
+}
+
+uint32_t can_replay_free(void)
+{
+  return CAN_REPLAY_BUFFER - (ring_head - ring_tail);
+}
+
+/**
+  * @brief  Start playback of the buffered records.
+  * @note   Resets the statistics.
+  * @param  delay_us time from now to the first record
+  * @retval false if running already or nothing is buffered
+  */
+bool can_replay_start(uint32_t delay_us)
+{
+  if (running || (ring_head == ring_tail) || (delay_us > (uint32_t)INT32_MAX))
+  {
+    return false;
+  }
+
+  __disable_irq();
+  released = 0U;
+  sent = 0U;
+  failed = 0U;
+  underruns = 0U;
+  min_error_us = INT32_MAX;
+  max_error_us = INT32_MIN;
+  error_sum_us = 0;
+  results_lost = 0U;
+  results_tail = results_head;
+  next_index = 0U;
+  starved = false;
+  start_us = (uint32_t)timestamp_now_us() + delay_us;
+
+  running = true;
+  service();
+  __HAL_TIM_CLEAR_FLAG(timer, TIM_FLAG_CC2);
+  __HAL_TIM_ENABLE_IT(timer, TIM_IT_CC2);
+  __enable_irq();
+
+  return true;
+}
+
+/**
+  * @brief  Stop playback and discard the buffered records.
+  * @note   Frames already queued still go out and are reported.
+  * @retval None
+  */
+void can_replay_stop(void)
+{
+  __disable_irq();
+  finish();
+  ring_tail = ring_head;
+  __enable_irq();
+
+  have_base = false;
+  ended = false;
+}
+
+bool can_replay_running(void)
+{
+  return running;
+}
+
+/**
+  * @brief  Statistics since can_replay_start.
+  * @param  stats filled in, errors are 0 until a frame was sent
+  * @retval None
+  */
+void can_replay_stats(can_replay_stats_t *stats)
+{
+  int64_t sum;
+
+  __disable_irq();
+  stats->released = released;
+  stats->sent = sent;
+  stats->failed = failed;
+  stats->underruns = underruns;
+  stats->min_error_us = min_error_us;
+  stats->max_error_us = max_error_us;
+  stats->results_lost = results_lost;
+  sum = error_sum_us;
+  __enable_irq();
+
+  if (stats->sent == 0U)
+  {
+    stats->min_error_us = 0;
+    stats->max_error_us = 0;
+    stats->mean_error_us = 0;
+    return;
+  }
+  stats->mean_error_us = (int32_t)(sum / (int64_t)stats->sent);
+}
+
+/**
+  * @brief  Fetch per frame results in the order the frames left their mailboxes.
+  * @param  out filled with up to max results
+  * @param  max capacity of out
+  * @retval number of results
+  */
+uint32_t can_replay_results(can_replay_result_t *out, uint32_t max)
+{
+  uint32_t tail = results_tail;
+  uint32_t head = results_head;
+  uint32_t count = 0U;
+
+  __DMB();
+  while ((tail != head) && (count < max))
+  {
+    out[count++] = results[tail & (CAN_REPLAY_RESULTS - 1U)];
+    tail++;
+  }
+  __DMB();
+  results_tail = tail;
+
+  return count;
+}
+
+/**
+  * @brief  A replayed frame left its mailbox, from the can_tx done callback.
+  * @param  tag CAN_REPLAY_TAG and the frame number
+  * @param  status CAN_TX_* outcome
+  * @param  time_us start of frame of a sent frame
+  * @retval None
+  */
+void can_replay_done(uint32_t tag, uint32_t status, uint64_t time_us)
+{
+  uint32_t index = tag & 0xFFFFU;
+  int32_t error = 0;
+
+  if (status == CAN_TX_SENT)
+  {
+    error = (int32_t)((uint32_t)time_us - due_us[index & (CAN_REPLAY_BUFFER - 1U)]);
+    sent++;
+    error_sum_us += error;
+    if (error < min_error_us)
+    {
+      min_error_us = error;
+    }
+    if (error > max_error_us)
+    {
+      max_error_us = error;
+    }
+  }
+  else
+  {
+    failed++;
+  }
+
+  uint32_t head = results_head;
+
+  if ((head - results_tail) < CAN_REPLAY_RESULTS)
+  {
+    can_replay_result_t *result = &results[head & (CAN_REPLAY_RESULTS - 1U)];
+
+    result->error_us = error;
+    result->index = (uint16_t)index;
+    result->status = (uint8_t)status;
+    __DMB();
+    results_head = head + 1U;
+  }
+  else
+  {
+    results_lost++;
+  }
+}
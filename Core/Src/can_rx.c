@@ -0,0 +1,393 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "can_rx.h"
+#include "timestamp.h"
+#include "can_time.h"
+
+/*
+ * Single producer / single consumer ring. The CAN RX interrupt is the only
+ * writer of ring_head, the main loop the only writer of ring_tail. Both
+ * indices run freely and are masked on access, so head - tail is the depth.
+ */
+static can_frame_t ring[CAN_RX_RING_SIZE];
+static volatile uint32_t ring_head;
+static volatile uint32_t ring_tail;
+static volatile uint32_t ring_high_water;
+static volatile uint32_t ring_dropped;
+static volatile uint32_t fifo_count[2];
+static volatile uint32_t fifo_full[2];
+static volatile uint32_t fifo_overrun[2];
+
+/* DWT cycles spent in drain_fifos and frames moved, for the RX hot path cost */
+static uint32_t rx_cycles;
+static uint32_t rx_frames;
+
+/* extends the TIME captures of received frames, see can_time.c */
+static can_time_t rx_clock;
+
+_Static_assert((CAN_RX_RING_SIZE & (CAN_RX_RING_SIZE - 1U)) == 0U, "CAN_RX_RING_SIZE must be a power of two");
+
+static HAL_StatusTypeDef config_mask_filter(CAN_HandleTypeDef *hcan, uint32_t bank, uint32_t fifo,
+                                            uint32_t id, uint32_t mask)
+{
+  CAN_FilterTypeDef filter = {0};
+
+  filter.FilterIdHigh = id >> 16;
+  filter.FilterIdLow = id & 0xFFFFU;
+  filter.FilterMaskIdHigh = mask >> 16;
+  filter.FilterMaskIdLow = mask & 0xFFFFU;
+  filter.FilterFIFOAssignment = fifo;
+  filter.FilterBank = bank;
+  filter.FilterMode = CAN_FILTERMODE_IDMASK;
+  filter.FilterScale = CAN_FILTERSCALE_32BIT;
+  filter.FilterActivation = CAN_FILTER_ENABLE;
+
+  return HAL_CAN_ConfigFilter(hcan, &filter);
+}
+
+/**
+  * @brief  Configure the acceptance filters, call before HAL_CAN_Start.
+  * @note   With split_std_id set, standard IDs below it are routed to FIFO0
+  *         and all other frames to FIFO1, doubling the hardware buffering and
+  *         keeping high priority IDs out of the bulk FIFO during bursts.
+  *         The FIFO1 side is built from disjoint mask filters so every ID
+  *         matches exactly one bank.
+  * @param  hcan pointer to the CAN handle
+  * @param  split_std_id power of two up to 0x400, or 0 to accept all into FIFO0
+  * @retval HAL status
+  */
+HAL_StatusTypeDef can_rx_config_filters(CAN_HandleTypeDef *hcan, uint32_t split_std_id)
+{
+  /* 32-bit filter register layout: STID[31:21] EXID[20:3] IDE[2] RTR[1] */
+  const uint32_t ide = CAN_ID_EXT;
+  const uint32_t stid_pos = 21U;
+
+  if (split_std_id == 0U)
+  {
+    return config_mask_filter(hcan, 0U, CAN_FILTER_FIFO0, 0U, 0U);
+  }
+
+  if (((split_std_id & (split_std_id - 1U)) != 0U) || (split_std_id > 0x400U))
+  {
+    return HAL_ERROR;
+  }
+
+  /* FIFO0: standard frames with all ID bits at or above split_std_id clear */
+  uint32_t high_bits = (0x7FFU & ~(split_std_id - 1U)) << stid_pos;
+  HAL_StatusTypeDef status = config_mask_filter(hcan, 0U, CAN_FILTER_FIFO0, 0U, high_bits | ide);
+
+  /* FIFO1: one bank per high ID bit, matching "this bit set, all above clear" */
+  uint32_t bank = 1U;
+  for (uint32_t bit = 0x400U; bit >= split_std_id; bit >>= 1)
+  {
+    uint32_t mask = (0x7FFU & ~(bit - 1U)) << stid_pos;
+    status |= config_mask_filter(hcan, bank++, CAN_FILTER_FIFO1, bit << stid_pos, mask | ide);
+  }
+
+  /* FIFO1: every extended frame */
+  status |= config_mask_filter(hcan, bank, CAN_FILTER_FIFO1, ide, ide);
+
+  return (status == HAL_OK) ? HAL_OK : HAL_ERROR;
+}
+
+/**
+  * @brief  Enable the message pending interrupts, call after HAL_CAN_Start.
+  * @param  hcan pointer to the CAN handle
+  * @retval HAL status
+  */
+HAL_StatusTypeDef can_rx_start(CAN_HandleTypeDef *hcan)
+{
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0U;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  can_time_init(&rx_clock, hcan->Instance);
+
+  return HAL_CAN_ActivateNotification(hcan, CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_RX_FIFO1_MSG_PENDING);
+}
+
+/**
+  * @brief  Copy the output mailbox of a FIFO word-wise and release it.
+  * @note   RFOM is written on its own instead of read-modify-write, so the
+  *         FULL and FOVR flags are left for the overrun accounting.
+  *         The next mailbox is only valid once hardware cleared RFOM again.
+  * @param  can CAN registers
+  * @param  RxFifo CAN_RX_FIFO0 or CAN_RX_FIFO1
+  * @param  frame destination record
+  * @retval None
+  */
+static inline void read_mailbox(CAN_TypeDef *can, uint32_t RxFifo, can_frame_t *frame)
+{
+  const CAN_FIFOMailBox_TypeDef *mailbox = &can->sFIFOMailBox[RxFifo];
+  volatile uint32_t *rfr = (RxFifo == CAN_RX_FIFO0) ? &can->RF0R : &can->RF1R;
+
+  frame->rir = mailbox->RIR;
+  frame->rdtr = mailbox->RDTR;
+  frame->data[0] = mailbox->RDLR;
+  frame->data[1] = mailbox->RDHR;
+
+  *rfr = CAN_RF0R_RFOM0;
+  while ((*rfr & CAN_RF0R_RFOM0) != 0U)
+  {
+  }
+}
+
+/**
+  * @brief  Empty a receive FIFO into an array of frame records.
+  * @note   Replaces one HAL_CAN_GetRxMessage call per frame, which checks the
+  *         handle state, reads every mailbox register several times and
+  *         unpacks the payload byte by byte.
+  * @param  can CAN registers
+  * @param  RxFifo CAN_RX_FIFO0 or CAN_RX_FIFO1
+  * @param  frames destination array
+  * @param  max capacity of frames
+  * @retval number of frames copied
+  */
+uint32_t can_rx_drain_fifo(CAN_TypeDef *can, uint32_t RxFifo, can_frame_t *frames, uint32_t max)
+{
+  volatile uint32_t *rfr = (RxFifo == CAN_RX_FIFO0) ? &can->RF0R : &can->RF1R;
+  uint32_t count = 0U;
+
+  while ((count < max) && ((*rfr & CAN_RF0R_FMP0) != 0U))
+  {
+    read_mailbox(can, RxFifo, &frames[count]);
+    count++;
+  }
+
+  return count;
+}
+
+/**
+  * @brief  Pick the FIFO holding the older frame.
+  * @note   Both FIFOs are in arrival order, so always taking the older head
+  *         merges them back into bus order. Relies on TTCM, the TIME field
+  *         is a 16-bit bit-time counter and compared with wraparound.
+  * @param  can CAN registers
+  * @param  other set to the number of frames pending in the FIFO not picked
+  * @retval CAN_RX_FIFO0 or CAN_RX_FIFO1, CAN_RX_FIFO1 + 1 if both are empty
+  */
+static uint32_t oldest_fifo(const CAN_TypeDef *can, uint32_t *other)
+{
+  uint32_t pending0 = can->RF0R & CAN_RF0R_FMP0;
+  uint32_t pending1 = can->RF1R & CAN_RF1R_FMP1;
+
+  if ((pending0 != 0U) && (pending1 != 0U))
+  {
+    uint16_t time0 = (uint16_t)(can->sFIFOMailBox[CAN_RX_FIFO0].RDTR >> CAN_RDT0R_TIME_Pos);
+    uint16_t time1 = (uint16_t)(can->sFIFOMailBox[CAN_RX_FIFO1].RDTR >> CAN_RDT1R_TIME_Pos);
+    if ((int16_t)(time1 - time0) < 0)
+    {
+      *other = pending0;
+      return CAN_RX_FIFO1;
+    }
+    *other = pending1;
+    return CAN_RX_FIFO0;
+  }
+
+  *other = 0U;
+  if (pending0 != 0U)
+  {
+    return CAN_RX_FIFO0;
+  }
+  if (pending1 != 0U)
+  {
+    return CAN_RX_FIFO1;
+  }
+  return CAN_RX_FIFO1 + 1U;
+}
+
+/**
+  * @brief  Extend the TIME captures of freshly drained frames.
+  * @param  frames records in bus order
+  * @param  count number of records
+  * @retval None
+  */
+static void stamp_frames(can_frame_t *frames, uint32_t count)
+{
+  uint64_t now = timestamp_now_us();
+
+  for (uint32_t i = 0U; i < count; i++)
+  {
+    frames[i].time_us = can_time_extend(&rx_clock, can_frame_time(&frames[i]), now);
+  }
+}
+
+/**
+  * @brief  Count and clear the FULL and FOVR flags of both FIFOs.
+  * @note   Polled on every drain instead of using the FF/FOV interrupts.
+  *         FOVR means at least one frame was lost in hardware, the exact
+  *         number is not available.
+  * @param  can CAN registers
+  * @retval None
+  */
+static void check_fifo_flags(CAN_TypeDef *can)
+{
+  volatile uint32_t *rfr[2] = { &can->RF0R, &can->RF1R };
+
+  for (uint32_t fifo = CAN_RX_FIFO0; fifo <= CAN_RX_FIFO1; fifo++)
+  {
+    uint32_t flags = *rfr[fifo] & (CAN_RF0R_FULL0 | CAN_RF0R_FOVR0);
+
+    if (flags != 0U)
+    {
+      if ((flags & CAN_RF0R_FULL0) != 0U)
+      {
+        fifo_full[fifo]++;
+      }
+      if ((flags & CAN_RF0R_FOVR0) != 0U)
+      {
+        fifo_overrun[fifo]++;
+      }
+      /* write one to clear, RFOM stays zero */
+      *rfr[fifo] = flags;
+    }
+  }
+}
+
+/**
+  * @brief  Drain both FIFOs into the ring in arrival order.
+  * @note   Runs from the RX0 and RX1 interrupts. Both share one NVIC
+  *         priority, so the ring still sees a single producer. While only
+  *         one FIFO holds frames it is emptied in one batch, otherwise the
+  *         older head is taken frame by frame.
+  * @param  hcan pointer to the CAN handle
+  * @retval None
+  */
+static void drain_fifos(CAN_HandleTypeDef *hcan)
+{
+  CAN_TypeDef *can = hcan->Instance;
+  uint32_t start = DWT->CYCCNT;
+  uint32_t frames = 0U;
+  uint32_t fifo;
+  uint32_t other;
+
+  check_fifo_flags(can);
+
+  while ((fifo = oldest_fifo(can, &other)) <= CAN_RX_FIFO1)
+  {
+    uint32_t head = ring_head;
+    uint32_t space = CAN_RX_RING_SIZE - (head - ring_tail);
+    uint32_t index = head & (CAN_RX_RING_SIZE - 1U);
+    uint32_t count;
+
+    if (space == 0U)
+    {
+      /* main loop is behind, the mailboxes still have to be released */
+      static can_frame_t discard[3];
+      count = can_rx_drain_fifo(can, fifo, discard, (other != 0U) ? 1U : 3U);
+      fifo_count[fifo] += count;
+      ring_dropped += count;
+      frames += count;
+      continue;
+    }
+
+    if (other != 0U)
+    {
+      space = 1U;
+    }
+    else if (space > CAN_RX_RING_SIZE - index)
+    {
+      space = CAN_RX_RING_SIZE - index;
+    }
+
+    count = can_rx_drain_fifo(can, fifo, &ring[index], space);
+    stamp_frames(&ring[index], count);
+    fifo_count[fifo] += count;
+    frames += count;
+
+    /* publish the slots only after they are completely written */
+    __DMB();
+    ring_head = head + count;
+
+    uint32_t depth = ring_head - ring_tail;
+    if (depth > ring_high_water)
+    {
+      ring_high_water = depth;
+    }
+  }
+
+  if (frames != 0U)
+  {
+    rx_cycles += DWT->CYCCNT - start;
+    rx_frames += frames;
+  }
+}
+
+/**
+  * @brief  FIFO0 message pending, called from USB_LP_CAN1_RX0_IRQHandler.
+  * @param  hcan pointer to the CAN handle
+  * @retval None
+  */
+void HAL_CAN_RxFifo0MsgPendingCallback(CAN_HandleTypeDef *hcan)
+{
+  drain_fifos(hcan);
+}
+
+/**
+  * @brief  FIFO1 message pending, called from CAN1_RX1_IRQHandler.
+  * @param  hcan pointer to the CAN handle
+  * @retval None
+  */
+void HAL_CAN_RxFifo1MsgPendingCallback(CAN_HandleTypeDef *hcan)
+{
+  drain_fifos(hcan);
+}
+
+/**
+  * @brief  Take the oldest frame out of the ring.
+  * @param  frame destination for the frame
+  * @retval true if a frame was copied, false if the ring is empty
+  */
+bool can_rx_pop(can_frame_t *frame)
+{
+  uint32_t tail = ring_tail;
+
+  if (tail == ring_head)
+  {
+    return false;
+  }
+
+  __DMB();
+  *frame = ring[tail & (CAN_RX_RING_SIZE - 1U)];
+  __DMB();
+  ring_tail = tail + 1U;
+
+  return true;
+}
+
+uint32_t can_rx_depth(void)
+{
+  return ring_head - ring_tail;
+}
+
+uint32_t can_rx_high_water(void)
+{
+  return ring_high_water;
+}
+
+uint32_t can_rx_dropped(void)
+{
+  return ring_dropped;
+}
+
+uint32_t can_rx_fifo_count(uint32_t RxFifo)
+{
+  return fifo_count[RxFifo & 1U];
+}
+
+uint32_t can_rx_fifo_full(uint32_t RxFifo)
+{
+  return fifo_full[RxFifo & 1U];
+}
+
+uint32_t can_rx_fifo_overrun(uint32_t RxFifo)
+{
+  return fifo_overrun[RxFifo & 1U];
+}
+
+uint32_t can_rx_cycles_per_frame(void)
+{
+  return (rx_frames != 0U) ? (rx_cycles / rx_frames) : 0U;
+}
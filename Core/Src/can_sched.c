@@ -0,0 +1,385 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "can_sched.h"
+#include "can_tx.h"
+#include "timestamp.h"
+
+/*
+ * Periodic transmission driven by output compare channel 1 of the
+ * timestamp timer. The entries wait in a binary min-heap ordered by their
+ * next release time. The compare interrupt queues every due entry with
+ * can_tx_queue and re-arms the compare for the earliest remaining one, so
+ * a release costs a few heap steps regardless of the table size.
+ *
+ * Release times are the low 32 bits of timestamp_now_us, compared as a
+ * signed difference. The 16-bit compare matches once per counter period
+ * (65.536 ms), an entry further out than that sees early interrupts that
+ * only re-arm.
+ *
+ * The actual period is measured between the start of frame of two
+ * transmissions of an entry, taken from the mailbox TIME field. An entry
+ * is not queued again while its previous frame is still pending, and a
+ * frame not sent within one period expires, so a congested bus skips
+ * releases instead of piling up stale copies.
+ */
+typedef struct
+{
+  uint32_t rir;
+  uint32_t rdtr;
+  uint32_t data[2];
+  uint32_t period_us;
+  uint32_t offset_us;
+  uint32_t due_us;
+  uint32_t last_us;
+  uint32_t count;
+  uint32_t min_period_us;
+  uint32_t max_period_us;
+  uint32_t missed;
+  bool pending;
+} sched_entry_t;
+
+/* first release after can_sched_start, leaves time to fill the heap */
+#define START_DELAY_US 1000U
+
+static TIM_HandleTypeDef *timer;
+static sched_entry_t entries[CAN_SCHED_MAX_ENTRIES];
+static uint32_t size;
+static uint8_t heap[CAN_SCHED_MAX_ENTRIES];
+static volatile bool running;
+
+_Static_assert(CAN_SCHED_MAX_ENTRIES <= 0xFFU, "CAN_SCHED_MAX_ENTRIES exceeds the heap index range");
+
+static bool earlier(uint32_t a, uint32_t b)
+{
+  return (int32_t)(entries[a].due_us - entries[b].due_us) < 0;
+}
+
+/**
+  * @brief  Restore the heap order below a position.
+  * @param  pos heap position whose entry may be late
+  * @retval None
+  */
+static void sift_down(uint32_t pos)
+{
+  for (;;)
+  {
+    uint32_t child = (2U * pos) + 1U;
+
+    if (child >= size)
+    {
+      return;
+    }
+    if ((child + 1U < size) && earlier(heap[child + 1U], heap[child]))
+    {
+      child++;
+    }
+    if (!earlier(heap[child], heap[pos]))
+    {
+      return;
+    }
+
+    uint8_t index = heap[pos];
+    heap[pos] = heap[child];
+    heap[child] = index;
+    pos = child;
+  }
+}
+
+/**
+  * @brief  Queue an entry and move it to its next period.
+  * @param  index entry index
+  * @param  now low part of timestamp_now_us
+  * @retval None
+  */
+static void release(uint32_t index, uint32_t now)
+{
+  sched_entry_t *entry = &entries[index];
+
+  if (entry->pending)
+  {
+    entry->missed++;
+  }
+  else
+  {
+    can_frame_t frame;
+
+    frame.rir = entry->rir;
+    frame.rdtr = entry->rdtr;
+    frame.data[0] = entry->data[0];
+    frame.data[1] = entry->data[1];
+    /* stale once the next instance is due */
+    if (can_tx_queue(&frame, CAN_SCHED_TAG | index, entry->period_us))
+    {
+      entry->pending = true;
+    }
+    else
+    {
+      entry->missed++;
+    }
+  }
+
+  entry->due_us += entry->period_us;
+
+  /* after a stall the missed periods are skipped, not sent in a burst */
+  int32_t late = (int32_t)(now - entry->due_us);
+  if (late >= 0)
+  {
+    uint32_t skipped = ((uint32_t)late / entry->period_us) + 1U;
+    entry->due_us += skipped * entry->period_us;
+    entry->missed += skipped;
+  }
+}
+
+/**
+  * @brief  Release all due entries and arm the compare for the next one.
+  * @note   Runs from the timer interrupt or with interrupts disabled.
+  * @retval None
+  */
+static void service(void)
+{
+  for (;;)
+  {
+    uint32_t now = (uint32_t)timestamp_now_us();
+    uint32_t index = heap[0];
+
+    if ((int32_t)(entries[index].due_us - now) > 0)
+    {
+      __HAL_TIM_SET_COMPARE(timer, TIM_CHANNEL_1, entries[index].due_us & 0xFFFFU);
+
+      /* done unless the due time passed while the compare was written */
+      if ((int32_t)(entries[index].due_us - (uint32_t)timestamp_now_us()) > 0)
+      {
+        return;
+      }
+      continue;
+    }
+
+    release(index, now);
+    sift_down(0U);
+  }
+}
+
+/**
+  * @brief  Compare match of channel 1.
+  * @retval None
+  */
+static void compare(void)
+{
+  if (running)
+  {
+    service();
+  }
+}
+
+/**
+  * @brief  Attach the timer, call after timestamp_start.
+  * @param  htim timestamp timer, channel 1 set up as output compare without output
+  * @retval None
+  */
+void can_sched_init(TIM_HandleTypeDef *htim)
+{
+  timer = htim;
+  size = 0U;
+  running = false;
+  timestamp_set_compare_callback(TIM_CHANNEL_1, compare);
+}
+
+/**
+  * @brief  Write a table entry.
+  * @note   Only while stopped. Entries are filled in order, index may be at
+  *         most the current size.
+  * @param  index entry index
+  * @param  frame record with rir in TIR layout
+  * @param  period_us transmit period
+  * @param  offset_us first transmission after start, or CAN_SCHED_AUTO_OFFSET
+  * @retval true if stored
+  */
+bool can_sched_set(uint32_t index, const can_frame_t *frame, uint32_t period_us, uint32_t offset_us)
+{
+  if (running || (index > size) || (index >= CAN_SCHED_MAX_ENTRIES) ||
+      (period_us < CAN_SCHED_MIN_PERIOD_US) || (period_us > (uint32_t)INT32_MAX))
+  {
+    return false;
+  }
+
+  if (offset_us == CAN_SCHED_AUTO_OFFSET)
+  {
+    offset_us = (index * CAN_SCHED_STAGGER_US) % period_us;
+  }
+  else if (offset_us > (uint32_t)INT32_MAX)
+  {
+    return false;
+  }
+
+  sched_entry_t *entry = &entries[index];
+
+  entry->rir = frame->rir;
+  entry->rdtr = frame->rdtr;
+  entry->data[0] = frame->data[0];
+  entry->data[1] = frame->data[1];
+  entry->period_us = period_us;
+  entry->offset_us = offset_us;
+  entry->pending = false;
+
+  if (index == size)
+  {
+    size++;
+  }
+
+  return true;
+}
+
+/**
+  * @brief  Remove all entries, stops the schedule.
+  * @retval None
+  */
+void can_sched_clear(void)
+{
+  can_sched_stop();
+  size = 0U;
+}
+
+uint32_t can_sched_size(void)
+{
+  return size;
+}
+
+/**
+  * @brief  Start transmitting, offsets count from now.
+  * @note   Resets the statistics.
+  * @retval true if started, false if the table is empty
+  */
+bool can_sched_start(void)
+{
+  if (running || (size == 0U))
+  {
+    return running;
+  }
+
+  uint32_t start = (uint32_t)timestamp_now_us() + START_DELAY_US;
+
+  for (uint32_t index = 0U; index < size; index++)
+  {
+    sched_entry_t *entry = &entries[index];
+
+    entry->due_us = start + entry->offset_us;
+    entry->count = 0U;
+    entry->min_period_us = UINT32_MAX;
+    entry->max_period_us = 0U;
+    entry->missed = 0U;
+    heap[index] = (uint8_t)index;
+  }
+  for (uint32_t pos = size / 2U; pos-- > 0U;)
+  {
+    sift_down(pos);
+  }
+
+  __disable_irq();
+  running = true;
+  service();
+  __HAL_TIM_CLEAR_FLAG(timer, TIM_FLAG_CC1);
+  __HAL_TIM_ENABLE_IT(timer, TIM_IT_CC1);
+  __enable_irq();
+
+  return true;
+}
+
+/**
+  * @brief  Stop releasing frames, frames already queued still go out.
+  * @retval None
+  */
+void can_sched_stop(void)
+{
+  __disable_irq();
+  __HAL_TIM_DISABLE_IT(timer, TIM_IT_CC1);
+  running = false;
+  __enable_irq();
+}
+
+bool can_sched_running(void)
+{
+  return running;
+}
+
+/**
+  * @brief  Statistics of an entry since can_sched_start.
+  * @param  index entry index
+  * @param  stats filled in, periods are 0 until two frames went out
+  * @retval None
+  */
+void can_sched_stats(uint32_t index, can_sched_stats_t *stats)
+{
+  const sched_entry_t *entry = &entries[index];
+
+  __disable_irq();
+  stats->count = entry->count;
+  stats->min_period_us = entry->min_period_us;
+  stats->max_period_us = entry->max_period_us;
+  stats->missed = entry->missed;
+  __enable_irq();
+
+  if (stats->count < 2U)
+  {
+    stats->min_period_us = 0U;
+    stats->max_period_us = 0U;
+    stats->jitter_us = 0U;
+    return;
+  }
+
+  uint32_t early = entry->period_us - stats->min_period_us;
+  uint32_t late = stats->max_period_us - entry->period_us;
+
+  if (stats->min_period_us > entry->period_us)
+  {
+    early = 0U;
+  }
+  if (stats->max_period_us < entry->period_us)
+  {
+    late = 0U;
+  }
+  stats->jitter_us = (early > late) ? early : late;
+}
+
+/**
+  * @brief  A scheduled frame left its mailbox, from the can_tx done callback.
+  * @param  tag CAN_SCHED_TAG and the entry index
+  * @param  status CAN_TX_* outcome
+  * @param  time_us start of frame of a sent frame
+  * @retval None
+  */
+void can_sched_done(uint32_t tag, uint32_t status, uint64_t time_us)
+{
+  uint32_t index = tag & ~CAN_SCHED_TAG;
+
+  if (index >= size)
+  {
+    return;
+  }
+
+  sched_entry_t *entry = &entries[index];
+
+  entry->pending = false;
+  if (status != CAN_TX_SENT)
+  {
+    entry->missed++;
+    return;
+  }
+
+  if (entry->count != 0U)
+  {
+    uint32_t period = (uint32_t)time_us - entry->last_us;
+
+    if (period < entry->min_period_us)
+    {
+      entry->min_period_us = period;
+    }
+    if (period > entry->max_period_us)
+    {
+      entry->max_period_us = period;
+    }
+  }
+  entry->count++;
+  entry->last_us = (uint32_t)time_us;
+}
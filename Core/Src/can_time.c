@@ -0,0 +1,113 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "can_time.h"
+
+/*
+ * TIME counts bit times in 16 bits and wraps after 131 ms at 500 kbit/s.
+ * Consecutive captures are unwrapped against the free-running microsecond
+ * timer: a short gap is taken as is, a long one gets the number of wraps
+ * that fits the elapsed time. Starting from the timer value at the first
+ * capture, the bit time differences accumulate into a monotonic time.
+ * CAN and timer clocks come from the same oscillator, so they do not drift
+ * apart; the constant offset is the interrupt latency of the first capture.
+ *
+ * Each sequence of captures (received frames, transmitted frames) needs
+ * its own state. Captures serviced out of order, like TX mailboxes that
+ * finished in priority order but are handled in index order, show up as
+ * a step back by less than half a wrap within a short gap and are taken
+ * as earlier times, not as a wrap.
+ */
+
+/**
+  * @brief  Nominal bit time of the active configuration.
+  * @param  can CAN registers
+  * @retval nanoseconds
+  */
+uint32_t can_time_bit_ns(const CAN_TypeDef *can)
+{
+  uint32_t btr = can->BTR;
+  uint32_t prescaler = ((btr & CAN_BTR_BRP) >> CAN_BTR_BRP_Pos) + 1U;
+  uint32_t quanta = 1U + ((btr & CAN_BTR_TS1) >> CAN_BTR_TS1_Pos) + 1U + ((btr & CAN_BTR_TS2) >> CAN_BTR_TS2_Pos) + 1U;
+
+  return (uint32_t)(((uint64_t)prescaler * quanta * 1000000000U) / HAL_RCC_GetPCLK1Freq());
+}
+
+/**
+  * @brief  Start a new sequence with the bit time of the active configuration.
+  * @note   TIME restarts with every HAL_CAN_Start, initialise again after it.
+  *         A restarted sequence stays monotonic.
+  * @param  clock extension state
+  * @param  can CAN registers
+  * @retval None
+  */
+void can_time_init(can_time_t *clock, const CAN_TypeDef *can)
+{
+  clock->bit_ns = can_time_bit_ns(can);
+  clock->half_wrap_us = (uint32_t)(((uint64_t)clock->bit_ns * 0x8000U) / 1000U);
+  clock->synced = false;
+}
+
+/**
+  * @brief  Extend the next TIME capture of a sequence.
+  * @param  clock extension state
+  * @param  time 16-bit TIME capture
+  * @param  now timestamp_now_us, not before the capture
+  * @retval microseconds on the timestamp_now_us time base
+  */
+uint64_t can_time_extend(can_time_t *clock, uint16_t time, uint64_t now)
+{
+  if (!clock->synced)
+  {
+    /* keep the time monotonic across a restart */
+    if (now > clock->last_us)
+    {
+      clock->last_us = now;
+    }
+    clock->last_frac_ns = 0U;
+    clock->synced = true;
+  }
+  else
+  {
+    uint64_t ticks = (uint16_t)(time - clock->last_time);
+    int64_t elapsed_us = (int64_t)(now - clock->last_us);
+
+    if ((elapsed_us <= (int64_t)clock->half_wrap_us) && (ticks >= 0x8000U))
+    {
+      /* earlier than the last capture */
+      uint64_t ns = (clock->last_us * 1000U) + clock->last_frac_ns - ((0x10000U - ticks) * clock->bit_ns);
+
+      clock->last_us = ns / 1000U;
+      clock->last_frac_ns = (uint32_t)(ns % 1000U);
+      clock->last_time = time;
+      return clock->last_us;
+    }
+
+    if (elapsed_us > (int64_t)clock->half_wrap_us)
+    {
+      /* long gap, add the wraps closest to the elapsed time */
+      uint64_t elapsed_ticks = ((uint64_t)elapsed_us * 1000U) / clock->bit_ns;
+      if (elapsed_ticks + 0x8000U > ticks)
+      {
+        ticks += ((elapsed_ticks + 0x8000U - ticks) >> 16) << 16;
+      }
+    }
+
+    uint64_t ns = (ticks * clock->bit_ns) + clock->last_frac_ns;
+    if (ns <= UINT32_MAX)
+    {
+      /* common case, 32-bit division */
+      clock->last_us += (uint32_t)ns / 1000U;
+      clock->last_frac_ns = (uint32_t)ns % 1000U;
+    }
+    else
+    {
+      clock->last_us += ns / 1000U;
+      clock->last_frac_ns = (uint32_t)(ns % 1000U);
+    }
+  }
+
+  clock->last_time = time;
+  return clock->last_us;
+}
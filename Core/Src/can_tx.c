@@ -0,0 +1,822 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "can_tx.h"
+#include "timestamp.h"
+#include "can_time.h"
+
+/*
+ * Software queue in front of the three TX mailboxes. Whenever a mailbox
+ * is released, successful or not, the TX interrupt loads the next frame,
+ * so all mailboxes stay busy and frames go out back to back.
+ *
+ * Frames live in a pool of slots. order[] holds the queued slots sorted by
+ * arbitration priority, the most urgent one last, so taking the next frame
+ * is a decrement and inserting shifts a few bytes. Equal priorities keep
+ * their queueing order. A slot stays allocated while its frame sits in a
+ * mailbox, so an aborted frame can be put back.
+ *
+ * The hardware already sends the mailbox with the lowest identifier first.
+ * Priority inversion happens when all mailboxes hold frames less urgent
+ * than a newly queued one; the least urgent mailbox is then aborted and its
+ * frame requeued from the abort callback.
+ *
+ * The main loop modifies the queue with interrupts disabled for a few
+ * cycles, everything else runs from the TX interrupt.
+ *
+ * A frame that lost arbitration or hit a transmit error (ALST or TERR in
+ * TSR, one-shot mode) may be retried in software up to a number of times
+ * and within a deadline counted from queueing. A lost arbitration goes
+ * back into the queue right away, after an error the frame is parked for
+ * a backoff that doubles with every attempt and can_tx_poll requeues it.
+ * Unlike automatic retransmission a dead bus cannot block a mailbox.
+ *
+ * A frame may carry a deadline. Once it has passed the frame is dropped
+ * when it reaches the head of the queue, and can_tx_poll discards it from
+ * the queue or aborts its mailbox, so a congested bus sheds stale frames
+ * instead of sending them late. Expired frames are counted per identifier.
+ *
+ * With time triggered mode the mailbox TIME field holds the start of frame
+ * of a transmitted frame. It is extended like the receive timestamps and
+ * passed to the done callback.
+ */
+typedef struct
+{
+  can_frame_t frame;
+  uint32_t key;         /* arbitration order, lower wins */
+  uint32_t queued_us;   /* low part of timestamp_now_us when queued */
+  uint32_t tag;         /* passed to the done callback */
+  uint32_t retry_at_us; /* end of the backoff while parked */
+  uint32_t deadline_us; /* dropped once this time has passed */
+  uint8_t attempts;     /* retries so far */
+  bool timed;           /* deadline_us is valid */
+} tx_slot_t;
+
+#define NO_SLOT 0xFFU
+
+/* the backoff stops doubling after this many retries */
+#define MAX_BACKOFF_SHIFT 8U
+
+/* why a mailbox is being aborted */
+#define ABORT_NONE    0U
+#define ABORT_PREEMPT 1U
+#define ABORT_EXPIRE  2U
+
+static CAN_HandleTypeDef *can;
+static tx_slot_t slots[CAN_TX_QUEUE_SIZE];
+static uint8_t free_slots[CAN_TX_QUEUE_SIZE];
+static uint32_t free_count;
+static uint8_t order[CAN_TX_QUEUE_SIZE];
+static volatile uint32_t queued;
+static uint8_t mailbox_slot[3];
+static uint8_t mailbox_abort[3];
+static bool fifo_mode;
+static can_tx_done_t done_callback;
+static can_time_t tx_clock;
+static uint8_t parked[CAN_TX_QUEUE_SIZE];
+static volatile uint32_t parked_count;
+static uint32_t retry_limit;
+static uint32_t retry_deadline_us;
+static uint32_t retry_backoff_us;
+static volatile uint32_t timed_count;
+static can_tx_expired_t expired_ids[CAN_TX_EXPIRED_IDS];
+static uint32_t expired_id_count;
+
+static uint32_t queue_high_water;
+static volatile uint32_t sent;
+static volatile uint32_t failed;
+static volatile uint32_t preempted;
+static volatile uint32_t retries;
+static volatile uint32_t give_ups;
+static volatile uint32_t expired;
+static volatile uint32_t expired_untracked;
+static uint32_t rejected;
+static uint32_t max_delay_us[CAN_TX_CLASSES];
+
+_Static_assert(CAN_TX_QUEUE_SIZE < NO_SLOT, "CAN_TX_QUEUE_SIZE exceeds the slot index range");
+
+/**
+  * @brief  Sort key in bus arbitration order.
+  * @note   The bits follow the arbitration field on the wire: base ID,
+  *         RTR (standard) or SRR (extended, always recessive), IDE, ID
+  *         extension, RTR (extended). A standard frame beats an extended
+  *         frame with the same base ID.
+  * @param  tir identifier word in TIR layout
+  * @retval key, lower values win arbitration
+  */
+static uint32_t arbitration_key(uint32_t tir)
+{
+  uint32_t rtr = ((tir & CAN_TI0R_RTR) != 0U) ? 1U : 0U;
+
+  if ((tir & CAN_TI0R_IDE) != 0U)
+  {
+    uint32_t id = tir >> CAN_TI0R_EXID_Pos;
+    return ((id >> 18) << 21) | (1U << 20) | (1U << 19) | ((id & 0x3FFFFU) << 1) | rtr;
+  }
+
+  return ((tir >> CAN_TI0R_STID_Pos) << 21) | (rtr << 20);
+}
+
+/**
+  * @brief  Write a frame record into a TX mailbox and request transmission.
+  * @param  mailbox empty mailbox, 0 to 2
+  * @param  frame record, rir in TIR layout
+  * @retval None
+  */
+static inline void load_mailbox(uint32_t mailbox, const can_frame_t *frame)
+{
+  CAN_TxMailBox_TypeDef *tx = &can->Instance->sTxMailBox[mailbox];
+
+  tx->TDTR = frame->rdtr & CAN_TDT0R_DLC;
+  tx->TDLR = frame->data[0];
+  tx->TDHR = frame->data[1];
+  tx->TIR = frame->rir | CAN_TI0R_TXRQ;
+}
+
+/**
+  * @brief  Put a slot into the sorted order.
+  * @param  slot slot index
+  * @param  first true to go ahead of queued frames with the same key
+  * @retval None
+  */
+static void insert(uint32_t slot, bool first)
+{
+  uint32_t key = slots[slot].key;
+  uint32_t pos = queued;
+
+  /* skip the more urgent frames at the end, and equal ones unless going first */
+  while ((pos > 0U) && (first ? (slots[order[pos - 1U]].key < key) : (slots[order[pos - 1U]].key <= key)))
+  {
+    pos--;
+  }
+  for (uint32_t i = queued; i > pos; i--)
+  {
+    order[i] = order[i - 1U];
+  }
+  order[pos] = (uint8_t)slot;
+  queued++;
+}
+
+static void release(uint32_t slot)
+{
+  if (slots[slot].timed)
+  {
+    timed_count--;
+  }
+  free_slots[free_count++] = (uint8_t)slot;
+}
+
+static bool is_expired(uint32_t slot, uint32_t now)
+{
+  return slots[slot].timed && ((int32_t)(now - slots[slot].deadline_us) >= 0);
+}
+
+/**
+  * @brief  Drop a frame past its deadline and count it for its identifier.
+  * @param  slot slot of the frame, no longer queued or in a mailbox
+  * @retval None
+  */
+static void expire(uint32_t slot)
+{
+  uint32_t rir = slots[slot].frame.rir;
+  uint32_t id = ((rir & CAN_TI0R_IDE) != 0U) ? (CAN_TX_ID_EXT | (rir >> CAN_TI0R_EXID_Pos)) : (rir >> CAN_TI0R_STID_Pos);
+  uint32_t i = 0U;
+
+  while ((i < expired_id_count) && (expired_ids[i].id != id))
+  {
+    i++;
+  }
+  if (i == expired_id_count)
+  {
+    if (i < CAN_TX_EXPIRED_IDS)
+    {
+      expired_ids[i].id = id;
+      expired_ids[i].count = 0U;
+      expired_id_count++;
+    }
+  }
+  if (i < CAN_TX_EXPIRED_IDS)
+  {
+    expired_ids[i].count++;
+  }
+  else
+  {
+    expired_untracked++;
+  }
+  expired++;
+
+  if (done_callback != NULL)
+  {
+    /* the full time, deadlines only compare the low part */
+    done_callback(slots[slot].tag, CAN_TX_EXPIRED, timestamp_now_us());
+  }
+  release(slot);
+}
+
+/**
+  * @brief  Move queued frames into the empty mailboxes.
+  * @note   Runs from the TX interrupt or with interrupts disabled.
+  * @retval None
+  */
+static void refill(void)
+{
+  uint32_t tsr;
+  uint32_t now = (timed_count != 0U) ? (uint32_t)timestamp_now_us() : 0U;
+
+  while ((queued != 0U) && (((tsr = can->Instance->TSR) & (CAN_TSR_TME0 | CAN_TSR_TME1 | CAN_TSR_TME2)) != 0U))
+  {
+    /* CODE holds the number of an empty mailbox */
+    uint32_t mailbox = (tsr & CAN_TSR_CODE) >> CAN_TSR_CODE_Pos;
+    uint32_t slot = order[--queued];
+
+    if (is_expired(slot, now))
+    {
+      expire(slot);
+      continue;
+    }
+
+    mailbox_slot[mailbox] = (uint8_t)slot;
+    mailbox_abort[mailbox] = ABORT_NONE;
+    load_mailbox(mailbox, &slots[slot].frame);
+  }
+}
+
+/**
+  * @brief  Discard stale queued and parked frames, abort stale mailboxes.
+  * @note   Runs with interrupts disabled.
+  * @param  now low part of timestamp_now_us
+  * @retval None
+  */
+static void expire_stale(uint32_t now)
+{
+  uint32_t kept = 0U;
+
+  for (uint32_t i = 0U; i < queued; i++)
+  {
+    uint32_t slot = order[i];
+
+    if (is_expired(slot, now))
+    {
+      expire(slot);
+    }
+    else
+    {
+      order[kept++] = (uint8_t)slot;
+    }
+  }
+  queued = kept;
+
+  kept = 0U;
+  for (uint32_t i = 0U; i < parked_count; i++)
+  {
+    uint32_t slot = parked[i];
+
+    if (is_expired(slot, now))
+    {
+      expire(slot);
+    }
+    else
+    {
+      parked[kept++] = (uint8_t)slot;
+    }
+  }
+  parked_count = kept;
+
+  for (uint32_t mailbox = 0U; mailbox < 3U; mailbox++)
+  {
+    uint32_t slot = mailbox_slot[mailbox];
+
+    if ((slot != NO_SLOT) && (mailbox_abort[mailbox] == ABORT_NONE) && is_expired(slot, now))
+    {
+      /* a frame already on the bus still completes normally */
+      mailbox_abort[mailbox] = ABORT_EXPIRE;
+      HAL_CAN_AbortTxRequest(can, CAN_TX_MAILBOX0 << mailbox);
+    }
+  }
+}
+
+/**
+  * @brief  Abort the least urgent mailbox if it blocks a more urgent frame.
+  * @note   Runs with interrupts disabled after queueing a frame.
+  * @param  key key of the new frame
+  * @retval None
+  */
+static void preempt(uint32_t key)
+{
+  uint32_t tsr = can->Instance->TSR;
+  uint32_t victim = 3U;
+  uint32_t victim_key = key;
+
+  if ((tsr & (CAN_TSR_TME0 | CAN_TSR_TME1 | CAN_TSR_TME2)) != 0U)
+  {
+    return;
+  }
+
+  for (uint32_t mailbox = 0U; mailbox < 3U; mailbox++)
+  {
+    uint32_t slot = mailbox_slot[mailbox];
+    if ((mailbox_abort[mailbox] == ABORT_NONE) && (slots[slot].key > victim_key))
+    {
+      victim = mailbox;
+      victim_key = slots[slot].key;
+    }
+  }
+
+  if (victim < 3U)
+  {
+    /* the frame may still win, then it completes normally */
+    mailbox_abort[victim] = ABORT_PREEMPT;
+    HAL_CAN_AbortTxRequest(can, CAN_TX_MAILBOX0 << victim);
+  }
+}
+
+/**
+  * @brief  Retry a failed frame if the policy allows it.
+  * @param  slot slot of the frame
+  * @param  status CAN_TX_ALST or CAN_TX_TERR
+  * @param  now low part of timestamp_now_us
+  * @retval true if the frame was requeued or parked
+  */
+static bool retry(uint32_t slot, uint32_t status, uint32_t now)
+{
+  tx_slot_t *entry = &slots[slot];
+  uint32_t shift = (entry->attempts < MAX_BACKOFF_SHIFT) ? entry->attempts : MAX_BACKOFF_SHIFT;
+  uint32_t backoff = (status == CAN_TX_TERR) ? (retry_backoff_us << shift) : 0U;
+
+  if ((entry->attempts >= retry_limit) || ((now + backoff - entry->queued_us) > retry_deadline_us) ||
+      (entry->timed && ((int32_t)(entry->deadline_us - (now + backoff)) <= 0)))
+  {
+    give_ups++;
+    return false;
+  }
+
+  entry->attempts++;
+  retries++;
+  if (backoff == 0U)
+  {
+    insert(slot, true);
+  }
+  else
+  {
+    entry->retry_at_us = now + backoff;
+    parked[parked_count++] = (uint8_t)slot;
+  }
+
+  return true;
+}
+
+/**
+  * @brief  A mailbox was released, account for it and reload.
+  * @param  mailbox mailbox number
+  * @param  status CAN_TX_SENT, CAN_TX_ALST or CAN_TX_TERR
+  * @retval None
+  */
+static void mailbox_done(uint32_t mailbox, uint32_t status)
+{
+  uint32_t slot = mailbox_slot[mailbox];
+  uint64_t now = timestamp_now_us();
+  uint64_t time_us = now;
+
+  if (status != CAN_TX_SENT)
+  {
+    bool stale = is_expired(slot, (uint32_t)now);
+
+    if (stale || retry(slot, status, (uint32_t)now))
+    {
+      if (stale)
+      {
+        expire(slot);
+      }
+      mailbox_slot[mailbox] = NO_SLOT;
+      refill();
+      return;
+    }
+  }
+
+  if (status == CAN_TX_SENT)
+  {
+    uint32_t delay = (uint32_t)now - slots[slot].queued_us;
+    uint32_t cls = slots[slot].key >> (32U - CAN_TX_CLASS_BITS);
+
+    sent++;
+    if (delay > max_delay_us[cls])
+    {
+      max_delay_us[cls] = delay;
+    }
+  }
+  else
+  {
+    failed++;
+  }
+
+  if (done_callback != NULL)
+  {
+    if (status == CAN_TX_SENT)
+    {
+      uint32_t time = (can->Instance->sTxMailBox[mailbox].TDTR & CAN_TDT0R_TIME) >> CAN_TDT0R_TIME_Pos;
+      time_us = can_time_extend(&tx_clock, (uint16_t)time, now);
+    }
+    done_callback(slots[slot].tag, status, time_us);
+  }
+
+  mailbox_slot[mailbox] = NO_SLOT;
+  release(slot);
+  refill();
+}
+
+/**
+  * @brief  A mailbox was aborted: requeue a preempted frame, drop an expired one.
+  * @param  mailbox mailbox number
+  * @retval None
+  */
+static void mailbox_aborted(uint32_t mailbox)
+{
+  uint32_t slot = mailbox_slot[mailbox];
+
+  mailbox_slot[mailbox] = NO_SLOT;
+  if (slot == NO_SLOT)
+  {
+    return;
+  }
+
+  if (mailbox_abort[mailbox] == ABORT_PREEMPT)
+  {
+    preempted++;
+    insert(slot, true);
+  }
+  else if (mailbox_abort[mailbox] == ABORT_EXPIRE)
+  {
+    expire(slot);
+  }
+  else
+  {
+    failed++;
+    if (done_callback != NULL)
+    {
+      done_callback(slots[slot].tag, CAN_TX_ABORTED, timestamp_now_us());
+    }
+    release(slot);
+  }
+  refill();
+}
+
+/**
+  * @brief  Enable the mailbox empty interrupt, call after HAL_CAN_Start.
+  * @param  hcan pointer to the CAN handle
+  * @retval HAL status
+  */
+HAL_StatusTypeDef can_tx_start(CAN_HandleTypeDef *hcan)
+{
+  can = hcan;
+  can_time_init(&tx_clock, hcan->Instance);
+  queued = 0U;
+  parked_count = 0U;
+  timed_count = 0U;
+  free_count = 0U;
+  for (uint32_t slot = 0U; slot < CAN_TX_QUEUE_SIZE; slot++)
+  {
+    release(slot);
+  }
+  for (uint32_t mailbox = 0U; mailbox < 3U; mailbox++)
+  {
+    mailbox_slot[mailbox] = NO_SLOT;
+    mailbox_abort[mailbox] = ABORT_NONE;
+  }
+
+  return HAL_CAN_ActivateNotification(hcan, CAN_IT_TX_MAILBOX_EMPTY);
+}
+
+/**
+  * @brief  Select the transmit order.
+  * @note   In FIFO mode frames leave in queueing order, the mailboxes are
+  *         served in request order (TXFP) and nothing is preempted. Change
+  *         the mode while nothing is queued.
+  * @param  fifo true for strict FIFO order, false for priority order
+  * @retval None
+  */
+void can_tx_set_fifo_mode(bool fifo)
+{
+  fifo_mode = fifo;
+  if (fifo)
+  {
+    SET_BIT(can->Instance->MCR, CAN_MCR_TXFP);
+  }
+  else
+  {
+    CLEAR_BIT(can->Instance->MCR, CAN_MCR_TXFP);
+  }
+}
+
+/**
+  * @brief  Set the software retry policy for ALST and TERR.
+  * @param  limit retries per frame, 0 gives up on the first failure
+  * @param  deadline_us no retry once this long has passed since queueing
+  * @param  backoff_us wait before retrying after a transmit error, doubled
+  *         for every retry the frame already had
+  * @retval None
+  */
+void can_tx_set_retry(uint32_t limit, uint32_t deadline_us, uint32_t backoff_us)
+{
+  __disable_irq();
+  retry_limit = limit;
+  retry_deadline_us = deadline_us;
+  retry_backoff_us = backoff_us;
+  __enable_irq();
+}
+
+/**
+  * @brief  Read the retry policy in effect.
+  * @param  limit set to the retries per frame
+  * @param  deadline_us set to the retry deadline
+  * @param  backoff_us set to the backoff after a transmit error
+  * @retval None
+  */
+void can_tx_get_retry(uint32_t *limit, uint32_t *deadline_us, uint32_t *backoff_us)
+{
+  *limit = retry_limit;
+  *deadline_us = retry_deadline_us;
+  *backoff_us = retry_backoff_us;
+}
+
+/**
+  * @brief  Requeue parked frames whose backoff has passed and drop frames
+  *         past their deadline, call from the main loop.
+  * @retval None
+  */
+void can_tx_poll(void)
+{
+  if ((parked_count == 0U) && (timed_count == 0U))
+  {
+    return;
+  }
+
+  uint32_t now = (uint32_t)timestamp_now_us();
+
+  __disable_irq();
+  if (timed_count != 0U)
+  {
+    expire_stale(now);
+  }
+  for (uint32_t i = 0U; i < parked_count;)
+  {
+    uint32_t slot = parked[i];
+
+    if ((int32_t)(now - slots[slot].retry_at_us) >= 0)
+    {
+      parked[i] = parked[--parked_count];
+      insert(slot, true);
+    }
+    else
+    {
+      i++;
+    }
+  }
+  refill();
+  if (!fifo_mode && (queued != 0U))
+  {
+    preempt(slots[order[queued - 1U]].key);
+  }
+  __enable_irq();
+}
+
+/**
+  * @brief  Register the function told about every frame leaving a mailbox.
+  * @note   Called from the TX interrupt with the tag given to can_tx_queue,
+  *         the outcome and a time on the timestamp_now_us time base: the
+  *         start of frame from the mailbox TIME field for a sent frame
+  *         (needs time triggered mode), the interrupt time otherwise.
+  * @param  callback function, NULL for none
+  * @retval None
+  */
+void can_tx_set_done_callback(can_tx_done_t callback)
+{
+  done_callback = callback;
+}
+
+/**
+  * @brief  Queue a frame for transmission, never blocks.
+  * @note   Callable from interrupts of the same priority as the CAN ones.
+  * @param  frame record with rir in TIR layout, see can_frame_set_header
+  * @param  tag passed to the done callback, CAN_TX_NO_TAG if unused
+  * @param  lifetime_us drop the frame if not sent within this time,
+  *         CAN_TX_NO_DEADLINE to keep it until sent, below 2^31
+  * @retval true if queued, false if the queue is full
+  */
+bool can_tx_queue(const can_frame_t *frame, uint32_t tag, uint32_t lifetime_us)
+{
+  uint32_t key = fifo_mode ? 0U : arbitration_key(frame->rir);
+  uint32_t queued_us = (uint32_t)timestamp_now_us();
+  bool ok = false;
+
+  __disable_irq();
+  if (free_count != 0U)
+  {
+    uint32_t slot = free_slots[--free_count];
+
+    slots[slot].frame = *frame;
+    slots[slot].key = key;
+    slots[slot].queued_us = queued_us;
+    slots[slot].tag = tag;
+    slots[slot].attempts = 0U;
+    slots[slot].timed = (lifetime_us != CAN_TX_NO_DEADLINE);
+    slots[slot].deadline_us = queued_us + lifetime_us;
+    if (slots[slot].timed)
+    {
+      timed_count++;
+    }
+    insert(slot, false);
+    refill();
+    if (!fifo_mode && (queued != 0U))
+    {
+      preempt(key);
+    }
+    ok = true;
+  }
+  uint32_t used = CAN_TX_QUEUE_SIZE - free_count;
+  __enable_irq();
+
+  if (!ok)
+  {
+    rejected++;
+  }
+  else if (used > queue_high_water)
+  {
+    queue_high_water = used;
+  }
+
+  return ok;
+}
+
+/**
+  * @brief  Free entries in the software queue.
+  * @note   Frames sitting in a mailbox still hold their entry.
+  * @retval number of frames that can be queued
+  */
+uint32_t can_tx_free(void)
+{
+  return free_count;
+}
+
+uint32_t can_tx_sent(void)
+{
+  return sent;
+}
+
+uint32_t can_tx_failed(void)
+{
+  return failed;
+}
+
+uint32_t can_tx_rejected(void)
+{
+  return rejected;
+}
+
+uint32_t can_tx_preempted(void)
+{
+  return preempted;
+}
+
+uint32_t can_tx_retries(void)
+{
+  return retries;
+}
+
+uint32_t can_tx_give_ups(void)
+{
+  return give_ups;
+}
+
+uint32_t can_tx_expired(void)
+{
+  return expired;
+}
+
+/**
+  * @brief  Expired frames per identifier.
+  * @param  ids filled with up to max identifiers, in order of first expiry
+  * @param  max capacity of ids
+  * @param  untracked expired frames of identifiers beyond CAN_TX_EXPIRED_IDS
+  * @retval number of entries written
+  */
+uint32_t can_tx_expired_ids(can_tx_expired_t *ids, uint32_t max, uint32_t *untracked)
+{
+  __disable_irq();
+  uint32_t count = (expired_id_count < max) ? expired_id_count : max;
+  for (uint32_t i = 0U; i < count; i++)
+  {
+    ids[i] = expired_ids[i];
+  }
+  *untracked = expired_untracked;
+  __enable_irq();
+
+  return count;
+}
+
+uint32_t can_tx_high_water(void)
+{
+  return queue_high_water;
+}
+
+/**
+  * @brief  Longest time from queueing to transmission in a priority class.
+  * @param  cls class, the top CAN_TX_CLASS_BITS of the identifier
+  * @retval microseconds
+  */
+uint32_t can_tx_max_delay(uint32_t cls)
+{
+  return max_delay_us[cls & (CAN_TX_CLASSES - 1U)];
+}
+
+/**
+  * @brief  Mailbox 0 transmitted, called from USB_HP_CAN1_TX_IRQHandler.
+  * @param  hcan pointer to the CAN handle
+  * @retval None
+  */
+void HAL_CAN_TxMailbox0CompleteCallback(CAN_HandleTypeDef *hcan)
+{
+  UNUSED(hcan);
+  mailbox_done(0U, CAN_TX_SENT);
+}
+
+/**
+  * @brief  Mailbox 1 transmitted, called from USB_HP_CAN1_TX_IRQHandler.
+  * @param  hcan pointer to the CAN handle
+  * @retval None
+  */
+void HAL_CAN_TxMailbox1CompleteCallback(CAN_HandleTypeDef *hcan)
+{
+  UNUSED(hcan);
+  mailbox_done(1U, CAN_TX_SENT);
+}
+
+/**
+  * @brief  Mailbox 2 transmitted, called from USB_HP_CAN1_TX_IRQHandler.
+  * @param  hcan pointer to the CAN handle
+  * @retval None
+  */
+void HAL_CAN_TxMailbox2CompleteCallback(CAN_HandleTypeDef *hcan)
+{
+  UNUSED(hcan);
+  mailbox_done(2U, CAN_TX_SENT);
+}
+
+/**
+  * @brief  Mailbox 0 aborted, called from USB_HP_CAN1_TX_IRQHandler.
+  * @param  hcan pointer to the CAN handle
+  * @retval None
+  */
+void HAL_CAN_TxMailbox0AbortCallback(CAN_HandleTypeDef *hcan)
+{
+  UNUSED(hcan);
+  mailbox_aborted(0U);
+}
+
+/**
+  * @brief  Mailbox 1 aborted, called from USB_HP_CAN1_TX_IRQHandler.
+  * @param  hcan pointer to the CAN handle
+  * @retval None
+  */
+void HAL_CAN_TxMailbox1AbortCallback(CAN_HandleTypeDef *hcan)
+{
+  UNUSED(hcan);
+  mailbox_aborted(1U);
+}
+
+/**
+  * @brief  Mailbox 2 aborted, called from USB_HP_CAN1_TX_IRQHandler.
+  * @param  hcan pointer to the CAN handle
+  * @retval None
+  */
+void HAL_CAN_TxMailbox2AbortCallback(CAN_HandleTypeDef *hcan)
+{
+  UNUSED(hcan);
+  mailbox_aborted(2U);
+}
+
+/**
+  * @brief  Arbitration lost or transmit error, retried or given up.
+  * @note   HAL accumulates the per mailbox TX error bits in ErrorCode.
+  * @param  hcan pointer to the CAN handle
+  * @retval None
+  */
+void HAL_CAN_ErrorCallback(CAN_HandleTypeDef *hcan)
+{
+  const uint32_t alst[3] = { HAL_CAN_ERROR_TX_ALST0, HAL_CAN_ERROR_TX_ALST1, HAL_CAN_ERROR_TX_ALST2 };
+  const uint32_t terr[3] = { HAL_CAN_ERROR_TX_TERR0, HAL_CAN_ERROR_TX_TERR1, HAL_CAN_ERROR_TX_TERR2 };
+
+  for (uint32_t mailbox = 0U; mailbox < 3U; mailbox++)
+  {
+    uint32_t errors = hcan->ErrorCode & (alst[mailbox] | terr[mailbox]);
+
+    if (errors != 0U)
+    {
+      hcan->ErrorCode &= ~errors;
+      if (mailbox_slot[mailbox] != NO_SLOT)
+      {
+        mailbox_done(mailbox, ((errors & terr[mailbox]) != 0U) ? CAN_TX_TERR : CAN_TX_ALST);
+      }
+    }
+  }
+}
@@ -0,0 +1,227 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <string.h>
+#include "host_link.h"
+#include "uart_rx.h"
+#include "uart_tx.h"
+
+/*
+ * Baud rate negotiation on the host link:
+ *
+ *   host   SET_BAUD(new)                    at the current rate
+ *   device BAUD(ACCEPTED, new)              at the current rate, then switches
+ *   host   PING                             at the new rate
+ *   device PONG, BAUD(VERIFIED, new)        at the new rate
+ *
+ * Without a valid ping within HOST_LINK_VERIFY_TIMEOUT_MS the device goes
+ * back to the last verified rate and reports BAUD(REVERTED).
+ */
+
+typedef enum
+{
+  LINK_IDLE,
+  LINK_SWITCHING, /* acknowledge still on the wire at the old rate */
+  LINK_VERIFYING, /* running at the new rate, waiting for a ping */
+} link_state_t;
+
+static UART_HandleTypeDef *uart;
+static link_state_t state;
+static uint32_t verified_baud;
+static uint32_t pending_baud;
+static uint32_t verify_start;
+
+/**
+  * @brief  Compute BRR for a rate from the actual PCLK1.
+  * @param  baud requested rate
+  * @param  brr register value
+  * @retval true if the resulting rate is within 2 % of the request
+  */
+static bool baud_to_brr(uint32_t baud, uint32_t *brr)
+{
+  uint32_t pclk = HAL_RCC_GetPCLK1Freq();
+
+  /* oversampling by 16, the fastest rate is PCLK1 / 16 */
+  if ((baud == 0U) || (baud > pclk / 16U))
+  {
+    return false;
+  }
+
+  *brr = UART_BRR_SAMPLING16(pclk, baud);
+
+  uint32_t actual = (pclk + (*brr / 2U)) / *brr;
+  uint32_t error = (actual > baud) ? (actual - baud) : (baud - actual);
+  return (error * 50U) <= baud;
+}
+
+static void set_baud(uint32_t baud)
+{
+  uint32_t brr;
+
+  if (baud_to_brr(baud, &brr))
+  {
+    uart->Instance->BRR = brr;
+    uart->Init.BaudRate = baud;
+  }
+}
+
+static void send_baud_status(uint8_t status, uint32_t baud)
+{
+  uint8_t payload[5];
+
+  payload[0] = status;
+  memcpy(&payload[1], &baud, sizeof(baud));
+  host_proto_send(HOST_MSG_BAUD, payload, sizeof(payload));
+}
+
+/**
+  * @brief  Apply HOST_CMD_SET_COALESCE and answer with the settings in effect.
+  * @param  packet packet received from the host
+  * @retval None
+  */
+static void set_coalesce(const host_packet_t *packet)
+{
+  /* the defaults host_proto_init starts with */
+  static uint16_t max_bytes = HOST_COALESCE_DEFAULT_BYTES;
+  static uint32_t max_us = HOST_COALESCE_DEFAULT_US;
+  static uint8_t adaptive = 1U;
+  uint8_t reply[1U + 2U + 4U + 1U] = { HOST_COALESCE_MALFORMED };
+
+  if (packet->len == 7U)
+  {
+    memcpy(&max_bytes, &packet->payload[0], sizeof(max_bytes));
+    memcpy(&max_us, &packet->payload[2], sizeof(max_us));
+    max_bytes = (max_bytes > HOST_PROTO_MAX_PAYLOAD) ? HOST_PROTO_MAX_PAYLOAD : max_bytes;
+    max_us = (max_us > HOST_COALESCE_MAX_US) ? HOST_COALESCE_MAX_US : max_us;
+    adaptive = (packet->payload[6] != 0U) ? 1U : 0U;
+    host_proto_set_coalescing(max_bytes, max_us, adaptive != 0U);
+    reply[0] = HOST_COALESCE_OK;
+  }
+
+  memcpy(&reply[1], &max_bytes, sizeof(max_bytes));
+  memcpy(&reply[3], &max_us, sizeof(max_us));
+  reply[7] = adaptive;
+  host_proto_send(HOST_MSG_COALESCE, reply, sizeof(reply));
+}
+
+static void pong(const host_packet_t *packet)
+{
+  uint8_t payload[HOST_PROTO_MAX_PAYLOAD];
+  uint32_t counters[3] = { uart_rx_errors(), uart_rx_dropped() + host_proto_dropped_packets(), host_proto_bad_packets() };
+  uint32_t echo = packet->len;
+
+  if (echo > sizeof(payload) - sizeof(counters))
+  {
+    echo = sizeof(payload) - sizeof(counters);
+  }
+  memcpy(payload, counters, sizeof(counters));
+  memcpy(&payload[sizeof(counters)], packet->payload, echo);
+  host_proto_send(HOST_MSG_PONG, payload, sizeof(counters) + echo);
+}
+
+/**
+  * @brief  Take over the host UART at its configured rate.
+  * @param  huart pointer to the UART handle
+  * @retval None
+  */
+void host_link_init(UART_HandleTypeDef *huart)
+{
+  uart = huart;
+  state = LINK_IDLE;
+  verified_baud = huart->Init.BaudRate;
+}
+
+/**
+  * @brief  Handle link level commands.
+  * @param  packet packet received from the host
+  * @retval true if the packet was a link command
+  */
+bool host_link_handle(const host_packet_t *packet)
+{
+  uint32_t baud;
+  uint32_t brr;
+
+  switch (packet->type)
+  {
+    case HOST_CMD_SET_BAUD:
+      if ((packet->len != sizeof(baud)) || (state != LINK_IDLE))
+      {
+        send_baud_status(HOST_BAUD_REJECTED, verified_baud);
+        return true;
+      }
+      memcpy(&baud, packet->payload, sizeof(baud));
+      if (!baud_to_brr(baud, &brr))
+      {
+        send_baud_status(HOST_BAUD_REJECTED, baud);
+        return true;
+      }
+      send_baud_status(HOST_BAUD_ACCEPTED, baud);
+      pending_baud = baud;
+      state = LINK_SWITCHING;
+      return true;
+
+    case HOST_CMD_SET_COALESCE:
+      set_coalesce(packet);
+      return true;
+
+    case HOST_CMD_PING:
+      pong(packet);
+      if (state == LINK_VERIFYING)
+      {
+        verified_baud = pending_baud;
+        state = LINK_IDLE;
+        send_baud_status(HOST_BAUD_VERIFIED, verified_baud);
+      }
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+/**
+  * @brief  Advance the baud switch, call from the main loop.
+  * @retval None
+  */
+void host_link_poll(void)
+{
+  switch (state)
+  {
+    case LINK_SWITCHING:
+      /* BRR must not change while the acknowledge is still shifting out */
+      if (uart_tx_idle() && (__HAL_UART_GET_FLAG(uart, UART_FLAG_TC) != RESET))
+      {
+        set_baud(pending_baud);
+        verify_start = HAL_GetTick();
+        state = LINK_VERIFYING;
+      }
+      break;
+
+    case LINK_VERIFYING:
+      if ((HAL_GetTick() - verify_start) > HOST_LINK_VERIFY_TIMEOUT_MS)
+      {
+        set_baud(verified_baud);
+        state = LINK_IDLE;
+        send_baud_status(HOST_BAUD_REVERTED, verified_baud);
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+/**
+  * @brief  Check whether a baud switch is waiting for the UART to drain.
+  * @retval true while nothing else should be queued for transmission
+  */
+bool host_link_switching(void)
+{
+  return state == LINK_SWITCHING;
+}
+
+uint32_t host_link_baud(void)
+{
+  return uart->Init.BaudRate;
+}
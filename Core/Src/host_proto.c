@@ -0,0 +1,482 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <string.h>
+#include "host_proto.h"
+#include "uart_tx.h"
+
+/*
+ * Encoding budget per 8 byte CAN frame: 21 byte record, about 6 CRC words
+ * and a COBS pass over 25 bytes, a few hundred cycles at 64 MHz. The
+ * shortest frame takes about 94 us on a 500 kbit/s bus, so this stays a few
+ * percent of the CPU even at full bus load; the UART line rate is the limit.
+ * Coalescing shares type, sequence number, CRC, COBS overhead, delimiter
+ * and the DMA restart between all records of a packet.
+ */
+static CRC_HandleTypeDef *crc;
+static uint32_t packet[(1U + HOST_PROTO_MAX_PAYLOAD + 4U + 3U) / 4U];
+static uint8_t wire[HOST_PROTO_MAX_WIRE];
+static uint16_t frame_seq;
+
+/* HOST_MSG_FRAMES packet being filled */
+static uint32_t batch[(1U + HOST_PROTO_MAX_PAYLOAD + 4U + 3U) / 4U];
+static uint32_t batch_len;
+static uint32_t batch_start;
+/* a frame was dropped after the open batch, later records need a new header */
+static bool batch_closed;
+static uint32_t flush_bytes;
+static uint32_t flush_cycles;
+static bool flush_adaptive;
+
+/*
+ * Receive side: host_proto_rx_parse COBS decodes straight into one of
+ * HOST_PROTO_RX_SLOTS packet buffers from the UART interrupt. Completed
+ * packets are published by rx_head, the main loop checks their CRC (the CRC
+ * unit is shared with sending) and releases them by advancing rx_tail.
+ */
+typedef struct
+{
+  uint32_t words[(1U + HOST_PROTO_MAX_PAYLOAD + 4U + 3U) / 4U];
+  uint32_t len;
+} rx_slot_t;
+
+static rx_slot_t rx_slots[HOST_PROTO_RX_SLOTS];
+static volatile uint32_t rx_head;
+static volatile uint32_t rx_tail;
+static bool rx_holding;
+
+/* decoder state, interrupt only */
+static bool rx_active;
+static bool rx_discard;
+static bool rx_no_slot;
+static bool rx_zero_pending;
+static uint32_t rx_remaining;
+static uint32_t rx_len;
+static volatile uint32_t malformed_packets;
+static volatile uint32_t dropped_packets;
+static uint32_t bad_packets;
+
+_Static_assert(3U + HOST_FRAME_RECORD_MAX <= 1U + HOST_PROTO_MAX_PAYLOAD, "frame record exceeds HOST_PROTO_MAX_PAYLOAD");
+
+/**
+  * @brief  COBS encode a buffer, the trailing 0x00 delimiter is not added.
+  * @param  src bytes to encode
+  * @param  len number of bytes
+  * @param  dst destination, len + len / 254 + 1 bytes
+  * @retval encoded length
+  */
+static uint32_t cobs_encode(const uint8_t *src, uint32_t len, uint8_t *dst)
+{
+  uint8_t *code_ptr = dst;
+  uint8_t *out = dst + 1;
+  uint8_t code = 1U;
+
+  for (uint32_t i = 0U; i < len; i++)
+  {
+    if (src[i] == 0U)
+    {
+      *code_ptr = code;
+      code_ptr = out++;
+      code = 1U;
+    }
+    else
+    {
+      *out++ = src[i];
+      code++;
+      if (code == 0xFFU)
+      {
+        *code_ptr = code;
+        code_ptr = out++;
+        code = 1U;
+      }
+    }
+  }
+  *code_ptr = code;
+
+  return (uint32_t)(out - dst);
+}
+
+/**
+  * @brief  CRC of a word aligned buffer, zero padded to whole words.
+  * @param  words buffer
+  * @param  len number of bytes
+  * @retval CRC-32/MPEG-2
+  */
+static uint32_t checksum(uint32_t *words, uint32_t len)
+{
+  uint8_t *bytes = (uint8_t *)words;
+  uint32_t count = (len + 3U) / 4U;
+
+  memset(&bytes[len], 0, (count * 4U) - len);
+  return HAL_CRC_Calculate(crc, words, count);
+}
+
+/**
+  * @brief  Append CRC, COBS encode and queue a packet.
+  * @param  words packet buffer with room for the CRC
+  * @param  len length of type and payload
+  * @retval true if queued
+  */
+static bool send_packet(uint32_t *words, uint32_t len)
+{
+  uint8_t *bytes = (uint8_t *)words;
+  uint32_t sum = checksum(words, len);
+
+  memcpy(&bytes[len], &sum, sizeof(sum));
+
+  uint32_t encoded = cobs_encode(bytes, len + sizeof(sum), wire);
+  wire[encoded++] = 0U;
+
+  return uart_tx_write(wire, encoded);
+}
+
+/**
+  * @brief  Attach the CRC unit used for packet checksums.
+  * @param  hcrc pointer to an initialised CRC handle
+  * @retval None
+  */
+void host_proto_init(CRC_HandleTypeDef *hcrc)
+{
+  crc = hcrc;
+  frame_seq = 0U;
+  batch_len = 0U;
+  batch_closed = false;
+
+  /* the cycle counter times the coalescing window */
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  host_proto_set_coalescing(HOST_COALESCE_DEFAULT_BYTES, HOST_COALESCE_DEFAULT_US, true);
+}
+
+/**
+  * @brief  Store one decoded byte of the packet being received.
+  * @param  c decoded byte
+  * @retval None
+  */
+static void rx_put(uint8_t c)
+{
+  rx_slot_t *slot = &rx_slots[rx_head % HOST_PROTO_RX_SLOTS];
+
+  /* the slot is rounded up to whole words, packets may not use the spare bytes */
+  if (rx_len < 1U + HOST_PROTO_MAX_PAYLOAD + sizeof(uint32_t))
+  {
+    ((uint8_t *)slot->words)[rx_len++] = c;
+  }
+  else
+  {
+    rx_discard = true;
+  }
+}
+
+/**
+  * @brief  Close the packet being received at a 0x00 delimiter.
+  * @retval None
+  */
+static void rx_end(void)
+{
+  if (rx_no_slot)
+  {
+    dropped_packets++;
+  }
+  else if (rx_discard || (rx_remaining != 0U) || (rx_len < 1U + sizeof(uint32_t)))
+  {
+    malformed_packets++;
+  }
+  else
+  {
+    rx_slots[rx_head % HOST_PROTO_RX_SLOTS].len = rx_len;
+    __DMB();
+    rx_head++;
+  }
+
+  rx_active = false;
+  rx_discard = false;
+  rx_no_slot = false;
+  rx_zero_pending = false;
+  rx_remaining = 0U;
+  rx_len = 0U;
+}
+
+/**
+  * @brief  Incremental COBS decoder for bytes from the host.
+  * @note   Runs in the UART interrupt as a uart_rx_parser_t. A packet that
+  *         finds no free slot is dropped as a whole, NULL marks lost bytes
+  *         and discards the packet in progress.
+  * @param  data received bytes
+  * @param  len number of bytes
+  * @retval None
+  */
+void host_proto_rx_parse(const uint8_t *data, uint32_t len)
+{
+  if (data == NULL)
+  {
+    rx_discard = rx_active;
+    return;
+  }
+
+  for (uint32_t i = 0U; i < len; i++)
+  {
+    uint8_t c = data[i];
+
+    if (c == 0U)
+    {
+      if (rx_active)
+      {
+        rx_end();
+      }
+      continue;
+    }
+
+    if (!rx_active)
+    {
+      rx_active = true;
+      rx_no_slot = (rx_head - rx_tail) >= HOST_PROTO_RX_SLOTS;
+    }
+    if (rx_discard || rx_no_slot)
+    {
+      continue;
+    }
+
+    if (rx_remaining == 0U)
+    {
+      /* code byte, the zero it stands for goes in before the next block */
+      if (rx_zero_pending)
+      {
+        rx_put(0U);
+      }
+      rx_remaining = c - 1U;
+      rx_zero_pending = (c < 0xFFU);
+    }
+    else
+    {
+      rx_put(c);
+      rx_remaining--;
+    }
+  }
+}
+
+/**
+  * @brief  Fetch the next valid packet received from the host.
+  * @note   Packets failing the CRC are counted and skipped. The previous
+  *         packet's slot is released by this call.
+  * @param  packet filled in with type and payload
+  * @retval true if a packet was received
+  */
+bool host_proto_receive(host_packet_t *packet)
+{
+  if (rx_holding)
+  {
+    rx_holding = false;
+    __DMB();
+    rx_tail++;
+  }
+
+  while (rx_tail != rx_head)
+  {
+    __DMB();
+    rx_slot_t *slot = &rx_slots[rx_tail % HOST_PROTO_RX_SLOTS];
+    uint8_t *bytes = (uint8_t *)slot->words;
+    uint32_t len = slot->len - sizeof(uint32_t);
+    uint32_t sum;
+
+    memcpy(&sum, &bytes[len], sizeof(sum));
+    if (checksum(slot->words, len) == sum)
+    {
+      packet->type = bytes[0];
+      packet->len = len - 1U;
+      packet->payload = &bytes[1];
+      rx_holding = true;
+      return true;
+    }
+
+    bad_packets++;
+    __DMB();
+    rx_tail++;
+  }
+
+  return false;
+}
+
+uint32_t host_proto_bad_packets(void)
+{
+  return bad_packets + malformed_packets;
+}
+
+uint32_t host_proto_dropped_packets(void)
+{
+  return dropped_packets;
+}
+
+/**
+  * @brief  Queue a packet for the host.
+  * @param  type one of HOST_MSG_*
+  * @param  payload packet payload
+  * @param  len payload length, at most HOST_PROTO_MAX_PAYLOAD
+  * @retval true if queued, false if too long or the UART ring is full
+  */
+bool host_proto_send(uint8_t type, const void *payload, uint32_t len)
+{
+  uint8_t *bytes = (uint8_t *)packet;
+
+  if (len > HOST_PROTO_MAX_PAYLOAD)
+  {
+    return false;
+  }
+
+  bytes[0] = type;
+  memcpy(&bytes[1], payload, len);
+
+  return send_packet(packet, 1U + len);
+}
+
+/**
+  * @brief  Set when frame records are flushed to the UART.
+  * @param  max_bytes flush once the payload reaches this size, clamped to
+  *         HOST_PROTO_MAX_PAYLOAD, 0 sends every frame on its own
+  * @param  max_us flush once the oldest record waited this long, clamped to
+  *         HOST_COALESCE_MAX_US
+  * @param  adaptive also flush whenever the UART runs idle
+  * @retval None
+  */
+void host_proto_set_coalescing(uint32_t max_bytes, uint32_t max_us, bool adaptive)
+{
+  host_proto_flush();
+
+  flush_bytes = (max_bytes > HOST_PROTO_MAX_PAYLOAD) ? HOST_PROTO_MAX_PAYLOAD : max_bytes;
+  flush_cycles = ((max_us > HOST_COALESCE_MAX_US) ? HOST_COALESCE_MAX_US : max_us) * (SystemCoreClock / 1000000U);
+  flush_adaptive = adaptive;
+}
+
+/**
+  * @brief  Queue the pending frame records.
+  * @retval true if nothing is pending any more, false if the UART ring is
+  *         too full and the records are kept for the next attempt
+  */
+bool host_proto_flush(void)
+{
+  if (batch_len == 0U)
+  {
+    return true;
+  }
+
+  /* checked up front, a failing uart_tx_write would count a drop */
+  if (uart_tx_free() < HOST_PROTO_MAX_WIRE)
+  {
+    return false;
+  }
+
+  send_packet(batch, batch_len);
+  batch_len = 0U;
+  batch_closed = false;
+  return true;
+}
+
+/**
+  * @brief  Flush pending frame records on timeout or idle UART, call from
+  *         the main loop.
+  * @retval None
+  */
+void host_proto_poll(void)
+{
+  if (batch_len == 0U)
+  {
+    return;
+  }
+
+  if ((flush_adaptive && uart_tx_idle()) || ((DWT->CYCCNT - batch_start) >= flush_cycles))
+  {
+    host_proto_flush();
+  }
+}
+
+/**
+  * @brief  Add a received CAN frame to the pending HOST_MSG_FRAMES packet.
+  * @note   The sequence number advances for every frame offered, so the
+  *         host sees a gap whenever a frame was lost on the way.
+  * @param  frame received frame record
+  * @retval true if queued, false if dropped because the UART ring is full
+  */
+bool host_proto_send_frame(const can_frame_t *frame)
+{
+  uint8_t *bytes = (uint8_t *)batch;
+  uint32_t dlc = can_frame_dlc(frame);
+  uint32_t id = can_frame_id(frame);
+  uint64_t timestamp = frame->time_us;
+  uint16_t seq = frame_seq++;
+
+  /* remote frames carry a DLC but no data bytes */
+  uint32_t size = can_frame_is_rtr(frame) ? 0U : dlc;
+
+  /* records are numbered from the header, none may follow a dropped one */
+  if ((batch_closed || (batch_len + 13U + size > 1U + HOST_PROTO_MAX_PAYLOAD)) && !host_proto_flush())
+  {
+    batch_closed = true;
+    return false;
+  }
+
+  if (batch_len == 0U)
+  {
+    bytes[0] = HOST_MSG_FRAMES;
+    memcpy(&bytes[1], &seq, sizeof(seq));
+    batch_len = 3U;
+    batch_start = DWT->CYCCNT;
+  }
+
+  uint8_t *record = &bytes[batch_len];
+  record[0] = (uint8_t)(dlc | (can_frame_is_ext(frame) ? HOST_FRAME_IDE : 0U) |
+                        (can_frame_is_rtr(frame) ? HOST_FRAME_RTR : 0U));
+  memcpy(&record[1], &id, sizeof(id));
+  memcpy(&record[5], &timestamp, sizeof(timestamp));
+  memcpy(&record[13], frame->data, size);
+  batch_len += 13U + size;
+
+  if (batch_len - 1U >= flush_bytes)
+  {
+    host_proto_flush();
+  }
+
+  return true;
+}
+
+/**
+  * @brief  Parse a frame record of a HOST_CMD_TX packet.
+  * @note   Fixed offsets only, no loops over the header; the data bytes are
+  *         copied into zeroed mailbox words.
+  * @param  data record: flags u8 | id u32 | data[dlc]
+  * @param  len bytes available
+  * @param  frame record in TIR layout, ready for can_tx_queue
+  * @retval bytes consumed, 0 if the record is malformed
+  */
+uint32_t host_proto_parse_frame(const uint8_t *data, uint32_t len, can_frame_t *frame)
+{
+  uint32_t flags;
+  uint32_t id;
+
+  if (len < 5U)
+  {
+    return 0U;
+  }
+
+  flags = data[0];
+  memcpy(&id, &data[1], sizeof(id));
+
+  uint32_t dlc = flags & HOST_FRAME_DLC_Msk;
+  bool ext = (flags & HOST_FRAME_IDE) != 0U;
+  bool rtr = (flags & HOST_FRAME_RTR) != 0U;
+  uint32_t size = 5U + (rtr ? 0U : dlc);
+
+  if ((dlc > 8U) || ((flags & ~(HOST_FRAME_DLC_Msk | HOST_FRAME_IDE | HOST_FRAME_RTR)) != 0U) ||
+      (id > (ext ? 0x1FFFFFFFU : 0x7FFU)) || (len < size))
+  {
+    return 0U;
+  }
+
+  can_frame_set_header(frame, id, ext, rtr, dlc);
+  frame->data[0] = 0U;
+  frame->data[1] = 0U;
+  memcpy(frame->data, &data[5], size - 5U);
+
+  return size;
+}
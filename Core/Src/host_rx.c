@@ -0,0 +1,200 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdio.h>
+#include <string.h>
+#include "host_rx.h"
+#include "host_link.h"
+#include "can_rx.h"
+#include "can_filter.h"
+#include "uart_rx.h"
+#include "uart_tx.h"
+
+/*
+ * Host side of the RX pipeline, shared by main_rx and main_bridge. Frames
+ * are pulled out of the FIFOs by the CAN interrupts and streamed out by
+ * DMA, the main loop only moves them from one ring to the other and
+ * leaves them in the CAN ring while the UART is behind.
+ */
+
+/* how often the loss counters are checked for changes */
+#define STATS_INTERVAL_MS 100U
+
+static CAN_HandleTypeDef *can;
+
+/**
+  * @brief  Set the CAN handle the filter commands configure.
+  * @param  hcan pointer to the CAN handle
+  * @retval None
+  */
+void host_rx_init(CAN_HandleTypeDef *hcan)
+{
+  can = hcan;
+}
+
+/**
+  * @brief  Send the loss and backlog counters as HOST_MSG_STATS.
+  * @param  only_on_change skip sending if nothing but the frame counts changed
+  * @retval None
+  */
+static void send_stats(bool only_on_change)
+{
+  static host_stats_t last;
+  host_stats_t stats;
+
+  for (uint32_t fifo = CAN_RX_FIFO0; fifo <= CAN_RX_FIFO1; fifo++)
+  {
+    stats.rx_frames[fifo] = can_rx_fifo_count(fifo);
+    stats.fifo_full[fifo] = can_rx_fifo_full(fifo);
+    stats.fifo_overrun[fifo] = can_rx_fifo_overrun(fifo);
+  }
+  stats.ring_dropped = can_rx_dropped();
+  stats.ring_high_water = can_rx_high_water();
+  stats.uart_tx_high_water = uart_tx_high_water();
+  stats.uart_tx_dropped = uart_tx_dropped();
+  stats.uart_rx_dropped = uart_rx_dropped() + host_proto_dropped_packets();
+  stats.uart_rx_errors = uart_rx_errors();
+  stats.bad_packets = host_proto_bad_packets();
+
+  /* frame counts change all the time, only the remaining counters trigger a report */
+  memcpy(last.rx_frames, stats.rx_frames, sizeof(stats.rx_frames));
+  if (only_on_change && memcmp(&last, &stats, sizeof(stats)) == 0)
+  {
+    return;
+  }
+
+  /* retried on the next interval rather than counted as another UART drop */
+  if (uart_tx_free() < HOST_PROTO_MAX_WIRE)
+  {
+    return;
+  }
+
+  host_proto_send(HOST_MSG_STATS, &stats, sizeof(stats));
+  last = stats;
+}
+
+/**
+  * @brief  Compile the filter ranges of HOST_CMD_SET_FILTERS, switch to
+  *         them and answer with HOST_MSG_FILTER_RESULT.
+  * @param  packet packet from host_proto_receive
+  * @retval None
+  */
+static void set_filters(const host_packet_t *packet)
+{
+  static can_filter_range_t ranges[(HOST_PROTO_MAX_PAYLOAD - 1U) / HOST_FILTER_RANGE];
+  static can_filter_table_t table;
+  uint8_t reply[1U + 1U + 4U + 1U + 4U] = { HOST_FILTER_MALFORMED };
+  uint32_t count = 0U;
+
+  if (packet->len >= 1U && (packet->len - 1U) % HOST_FILTER_RANGE == 0U &&
+      (packet->len - 1U) / HOST_FILTER_RANGE <= sizeof(ranges) / sizeof(ranges[0]))
+  {
+    for (uint32_t pos = 1U; pos < packet->len; pos += HOST_FILTER_RANGE)
+    {
+      ranges[count].flags = packet->payload[pos];
+      memcpy(&ranges[count].first, &packet->payload[pos + 1U], 4U);
+      memcpy(&ranges[count].last, &packet->payload[pos + 5U], 4U);
+      count++;
+    }
+
+    /* 0: as many banks as the switch can take without a gap */
+    uint32_t max_banks = packet->payload[0];
+    if (max_banks == 0U)
+    {
+      max_banks = can_filter_spare(can);
+      max_banks = (max_banks != 0U) ? max_banks : CAN_FILTER_BANKS;
+    }
+
+    if (can_filter_compile(ranges, count, max_banks, &table))
+    {
+      can_filter_swap_t swap = {0};
+
+      reply[0] = HOST_FILTER_FAILED;
+      if (can_filter_swap(can, &table, &swap) == HAL_OK)
+      {
+        uint32_t gap_ns = swap.gap_cycles * 1000U / (SystemCoreClock / 1000000U);
+
+        reply[0] = HOST_FILTER_OK;
+        reply[1] = (uint8_t)table.count;
+        memcpy(&reply[2], &table.false_accepts, 4U);
+        reply[6] = swap.hitless ? 1U : 0U;
+        memcpy(&reply[7], &gap_ns, 4U);
+      }
+    }
+  }
+
+  host_proto_send(HOST_MSG_FILTER_RESULT, reply, sizeof(reply));
+}
+
+/**
+  * @brief  Handle an RX side command.
+  * @param  packet packet from host_proto_receive
+  * @retval false if the packet is not an RX side command
+  */
+bool host_rx_handle(const host_packet_t *packet)
+{
+  switch (packet->type)
+  {
+    case HOST_CMD_GET_STATS:
+      send_stats(false);
+      return true;
+
+    case HOST_CMD_SET_FILTERS:
+      set_filters(packet);
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+/**
+  * @brief  Forward a received frame and report changed loss counters, call
+  *         from the main loop.
+  * @param  reserve UART ring bytes left free for other packets, 0 if frames
+  *         are the only traffic
+  * @retval None
+  */
+void host_rx_poll(uint32_t reserve)
+{
+  static uint32_t stats_tick;
+  can_frame_t frame;
+
+  if (HAL_GetTick() - stats_tick >= STATS_INTERVAL_MS)
+  {
+    stats_tick = HAL_GetTick();
+    send_stats(true);
+  }
+
+  /* hold frames back while the UART drains before a baud switch */
+  if (host_link_switching())
+  {
+    return;
+  }
+
+  /* a new record may complete a packet, keep room for a full one */
+  if (uart_tx_free() >= HOST_PROTO_MAX_WIRE + reserve && can_rx_pop(&frame))
+  {
+    host_proto_send_frame(&frame);
+  }
+  host_proto_poll();
+}
+
+/**
+  * @brief  Send ring depth, high-water mark and drops as text.
+  * @retval None
+  */
+void host_rx_report(void)
+{
+  char line[128];
+  int len = snprintf(line, sizeof(line),
+                     "rx fifo0=%lu fifo1=%lu depth=%lu hwm=%lu/%lu dropped=%lu cycles/frame=%lu"
+                     " uart hwm=%lu/%lu",
+                     (unsigned long)can_rx_fifo_count(CAN_RX_FIFO0), (unsigned long)can_rx_fifo_count(CAN_RX_FIFO1),
+                     (unsigned long)can_rx_depth(), (unsigned long)can_rx_high_water(),
+                     (unsigned long)CAN_RX_RING_SIZE, (unsigned long)can_rx_dropped(),
+                     (unsigned long)can_rx_cycles_per_frame(),
+                     (unsigned long)uart_tx_high_water(), (unsigned long)UART_TX_BUFFER_SIZE);
+  host_proto_send(HOST_MSG_TEXT, line, (uint32_t)len);
+}
@@ -0,0 +1,584 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdio.h>
+#include <string.h>
+#include "host_tx.h"
+#include "host_link.h"
+#include "can_tx.h"
+#include "can_sched.h"
+#include "can_load.h"
+#include "can_replay.h"
+#include "uart_tx.h"
+
+/*
+ * Host side of the TX pipeline: TX batches, the schedule table, the retry
+ * policy, the load generator and trace replay, shared by main_tx and
+ * main_bridge.
+ *
+ * Every host frame is tagged with its record number. The CAN TX interrupt
+ * puts its outcome into a ring, the main loop sends the ring as
+ * HOST_MSG_TX_CONFIRM packets whenever the UART has room for one.
+ */
+
+/* can_tx tag of host frames, the record number in the low 16 bits */
+#define HOST_FRAME_TAG 0x10000U
+
+/* confirmations buffered between the CAN TX interrupt and the main loop, power of two */
+#define CONFIRM_RING_SIZE 64U
+
+/* outcome of a host frame, see HOST_MSG_TX_CONFIRM */
+typedef struct
+{
+  uint64_t time_us;
+  uint16_t seq;
+  uint8_t status;
+} tx_confirm_t;
+
+/* written by the CAN TX interrupt (head) and the main loop (tail) */
+static tx_confirm_t confirm_ring[CONFIRM_RING_SIZE];
+static volatile uint32_t confirm_head;
+static volatile uint32_t confirm_tail;
+static volatile uint32_t confirm_lost;
+
+/**
+  * @brief  Queue the frames of a HOST_CMD_TX or _TX_TIMED packet, acknowledge the batch.
+  * @param  packet command packet
+  * @retval None
+  */
+static void transmit(const host_packet_t *packet)
+{
+  /* a record takes at least 5 bytes, so the failures always fit one packet */
+  uint8_t ack[3U + 2U * ((HOST_PROTO_MAX_PAYLOAD - 2U) / 5U)];
+  uint32_t ack_len = 3U;
+  uint32_t count = 0U;
+  uint32_t pos = (packet->type == HOST_CMD_TX_TIMED) ? 6U : 2U;
+  uint32_t lifetime_us = CAN_TX_NO_DEADLINE;
+  uint16_t seq;
+
+  if (packet->len < pos)
+  {
+    /* short header, still acknowledged so the host window does not leak */
+    ack[0] = (packet->len >= 2U) ? packet->payload[0] : 0U;
+    ack[1] = (packet->len >= 2U) ? packet->payload[1] : 0U;
+    ack[2] = 1U;
+    ack[3] = 0U;
+    ack[4] = HOST_TX_MALFORMED;
+    host_proto_send(HOST_MSG_TX_ACK, ack, 5U);
+    return;
+  }
+  memcpy(ack, packet->payload, 2U);
+  memcpy(&seq, packet->payload, 2U);
+  if (pos == 6U)
+  {
+    memcpy(&lifetime_us, &packet->payload[2], 4U);
+  }
+
+  while (pos < packet->len)
+  {
+    can_frame_t frame;
+    uint32_t used = host_proto_parse_frame(&packet->payload[pos], packet->len - pos, &frame);
+    uint8_t status = HOST_TX_MALFORMED;
+
+    if (used != 0U)
+    {
+      uint32_t tag = HOST_FRAME_TAG | (uint16_t)(seq + count);
+      status = can_tx_queue(&frame, tag, lifetime_us) ? HOST_TX_QUEUED : HOST_TX_FULL;
+    }
+    if (status != HOST_TX_QUEUED)
+    {
+      ack[ack_len++] = (uint8_t)count;
+      ack[ack_len++] = status;
+    }
+    count++;
+
+    if (used == 0U)
+    {
+      break;
+    }
+    pos += used;
+  }
+
+  ack[2] = (uint8_t)count;
+  host_proto_send(HOST_MSG_TX_ACK, ack, ack_len);
+}
+
+/**
+  * @brief  Load, start or stop the schedule table, acknowledge with the table size.
+  * @param  packet HOST_CMD_SCHED_LOAD, _START or _STOP
+  * @retval None
+  */
+static void schedule(const host_packet_t *packet)
+{
+  uint8_t ack[3] = { packet->type, HOST_SCHED_OK, 0U };
+
+  if (packet->type == HOST_CMD_SCHED_START)
+  {
+    if (!can_sched_start())
+    {
+      ack[1] = HOST_SCHED_EMPTY;
+    }
+  }
+  else if (packet->type == HOST_CMD_SCHED_STOP)
+  {
+    can_sched_stop();
+  }
+  else if (can_sched_running())
+  {
+    ack[1] = HOST_SCHED_RUNNING;
+  }
+  else if (packet->len < 1U)
+  {
+    ack[1] = HOST_SCHED_MALFORMED;
+  }
+  else
+  {
+    uint32_t index = packet->payload[0];
+    uint32_t pos = 1U;
+
+    if (index == 0U)
+    {
+      can_sched_clear();
+    }
+
+    while (pos < packet->len)
+    {
+      /* period u32 | offset u32 | TX record */
+      can_frame_t frame;
+      uint32_t period_us = 0U;
+      uint32_t offset_us = 0U;
+      uint32_t used = 0U;
+
+      if (packet->len - pos > 8U)
+      {
+        memcpy(&period_us, &packet->payload[pos], 4U);
+        memcpy(&offset_us, &packet->payload[pos + 4U], 4U);
+        used = host_proto_parse_frame(&packet->payload[pos + 8U], packet->len - pos - 8U, &frame);
+      }
+      if (used == 0U || !can_sched_set(index, &frame, period_us, offset_us))
+      {
+        ack[1] = HOST_SCHED_MALFORMED;
+        break;
+      }
+      index++;
+      pos += 8U + used;
+    }
+  }
+
+  ack[2] = (uint8_t)can_sched_size();
+  host_proto_send(HOST_MSG_SCHED_ACK, ack, sizeof(ack));
+}
+
+/**
+  * @brief  Answer HOST_CMD_SCHED_STATS with the statistics of a range of entries.
+  * @param  packet command packet
+  * @retval None
+  */
+static void send_sched_stats(const host_packet_t *packet)
+{
+  uint8_t reply[1U + ((HOST_PROTO_MAX_PAYLOAD - 1U) / sizeof(can_sched_stats_t)) * sizeof(can_sched_stats_t)];
+  uint32_t len = 1U;
+
+  /* a short request gets an empty answer */
+  uint32_t index = (packet->len >= 1U) ? packet->payload[0] : 0U;
+  uint32_t count = (packet->len >= 2U) ? packet->payload[1] : 0U;
+
+  reply[0] = (uint8_t)index;
+  while (count > 0U && index < can_sched_size() && len + sizeof(can_sched_stats_t) <= sizeof(reply))
+  {
+    can_sched_stats_t stats;
+
+    can_sched_stats(index, &stats);
+    memcpy(&reply[len], &stats, sizeof(stats));
+    len += sizeof(stats);
+    index++;
+    count--;
+  }
+
+  host_proto_send(HOST_MSG_SCHED_STATS, reply, len);
+}
+
+/**
+  * @brief  A frame left its mailbox, called from the CAN TX interrupt.
+  * @note   Scheduled frames go to their entry, generated load and replayed
+  *         frames to their statistics, host frames are buffered for
+  *         HOST_MSG_TX_CONFIRM.
+  * @param  tag tag given to can_tx_queue
+  * @param  status CAN_TX_* outcome, same values as HOST_CONFIRM_*
+  * @param  time_us start of frame of a sent frame
+  * @retval None
+  */
+static void tx_done(uint32_t tag, uint32_t status, uint64_t time_us)
+{
+  if ((tag & CAN_SCHED_TAG) != 0U)
+  {
+    can_sched_done(tag, status, time_us);
+  }
+  else if ((tag & CAN_LOAD_TAG) != 0U)
+  {
+    can_load_done(tag, status, time_us);
+  }
+  else if ((tag & CAN_REPLAY_TAG) != 0U)
+  {
+    can_replay_done(tag, status, time_us);
+  }
+  else if ((tag & HOST_FRAME_TAG) != 0U)
+  {
+    uint32_t head = confirm_head;
+
+    if (head - confirm_tail < CONFIRM_RING_SIZE)
+    {
+      tx_confirm_t *confirm = &confirm_ring[head & (CONFIRM_RING_SIZE - 1U)];
+
+      confirm->time_us = time_us;
+      confirm->seq = (uint16_t)tag;
+      confirm->status = (uint8_t)status;
+      __DMB();
+      confirm_head = head + 1U;
+    }
+    else
+    {
+      confirm_lost++;
+    }
+  }
+}
+
+/**
+  * @brief  Send the buffered confirmations as one HOST_MSG_TX_CONFIRM packet.
+  * @retval None
+  */
+static void send_confirmations(void)
+{
+  uint8_t payload[4U + ((HOST_PROTO_MAX_PAYLOAD - 4U) / HOST_CONFIRM_RECORD) * HOST_CONFIRM_RECORD];
+  uint32_t len = 4U;
+  uint32_t tail = confirm_tail;
+  uint32_t head = confirm_head;
+
+  if (tail == head || uart_tx_free() < HOST_PROTO_MAX_WIRE)
+  {
+    return;
+  }
+
+  __DMB();
+  while (tail != head && len + HOST_CONFIRM_RECORD <= sizeof(payload))
+  {
+    const tx_confirm_t *confirm = &confirm_ring[tail & (CONFIRM_RING_SIZE - 1U)];
+
+    memcpy(&payload[len], &confirm->seq, 2U);
+    payload[len + 2U] = confirm->status;
+    memcpy(&payload[len + 3U], &confirm->time_us, 8U);
+    len += HOST_CONFIRM_RECORD;
+    tail++;
+  }
+  __DMB();
+  confirm_tail = tail;
+
+  uint32_t lost = confirm_lost;
+  memcpy(payload, &lost, 4U);
+  host_proto_send(HOST_MSG_TX_CONFIRM, payload, len);
+}
+
+/**
+  * @brief  Answer HOST_CMD_GET_EXPIRED with the expired frames per identifier.
+  * @retval None
+  */
+static void send_expired(void)
+{
+  can_tx_expired_t ids[CAN_TX_EXPIRED_IDS];
+  uint8_t payload[8U + sizeof(ids)];
+  uint32_t untracked;
+  uint32_t count = can_tx_expired_ids(ids, CAN_TX_EXPIRED_IDS, &untracked);
+  uint32_t total = can_tx_expired();
+
+  memcpy(&payload[0], &total, 4U);
+  memcpy(&payload[4], &untracked, 4U);
+  memcpy(&payload[8], ids, count * sizeof(ids[0]));
+  host_proto_send(HOST_MSG_EXPIRED, payload, 8U + count * sizeof(ids[0]));
+}
+
+/**
+  * @brief  Handle the bus load commands, each answered with HOST_MSG_LOAD_STATS.
+  * @param  packet command packet
+  * @retval None
+  */
+static void load(const host_packet_t *packet)
+{
+  uint8_t reply[2U + 8U + 4U + 4U + 8U + 4U + 4U];
+  can_load_stats_t stats;
+
+  reply[0] = HOST_LOAD_OK;
+  if (packet->type == HOST_CMD_LOAD_START)
+  {
+    can_load_config_t config;
+
+    reply[0] = HOST_LOAD_MALFORMED;
+    if (packet->len == HOST_LOAD_CONFIG)
+    {
+      /* load % u8 | id min u32 | id max u32 | flags u8 | DLC weights 9 x u8 | seed u32 */
+      config.load_percent = packet->payload[0];
+      memcpy(&config.id_min, &packet->payload[1], 4U);
+      memcpy(&config.id_max, &packet->payload[5], 4U);
+      config.flags = packet->payload[9];
+      memcpy(config.dlc_weights, &packet->payload[10], 9U);
+      memcpy(&config.seed, &packet->payload[19], 4U);
+      if (can_load_start(&config))
+      {
+        reply[0] = HOST_LOAD_OK;
+      }
+    }
+  }
+  else if (packet->type == HOST_CMD_LOAD_STOP)
+  {
+    can_load_stop();
+  }
+
+  can_load_stats(&stats);
+  reply[1] = can_load_running() ? 1U : 0U;
+  memcpy(&reply[2], &stats.elapsed_us, 8U);
+  memcpy(&reply[10], &stats.frames, 4U);
+  memcpy(&reply[14], &stats.failed, 4U);
+  memcpy(&reply[18], &stats.bits, 8U);
+  memcpy(&reply[26], &stats.frames_per_s, 4U);
+  memcpy(&reply[30], &stats.load_permille, 4U);
+  host_proto_send(HOST_MSG_LOAD_STATS, reply, sizeof(reply));
+}
+
+/**
+  * @brief  Handle the trace replay commands, each answered with HOST_MSG_REPLAY_STATUS.
+  * @param  packet command packet
+  * @retval None
+  */
+static void replay(const host_packet_t *packet)
+{
+  uint8_t reply[5U + 9U * 4U];
+  can_replay_stats_t stats;
+  uint32_t stored = 0U;
+
+  reply[0] = HOST_REPLAY_OK;
+  if ((packet->type == HOST_CMD_REPLAY_DATA) && (packet->len < 1U))
+  {
+    reply[0] = HOST_REPLAY_MALFORMED;
+  }
+  else if (packet->type == HOST_CMD_REPLAY_DATA)
+  {
+    uint32_t pos = 1U;
+
+    while (pos < packet->len)
+    {
+      /* trace time u32 | TX record */
+      can_frame_t frame;
+      uint32_t time_us = 0U;
+      uint32_t used = 0U;
+
+      if (packet->len - pos > 4U)
+      {
+        memcpy(&time_us, &packet->payload[pos], 4U);
+        used = host_proto_parse_frame(&packet->payload[pos + 4U], packet->len - pos - 4U, &frame);
+      }
+      if (used == 0U)
+      {
+        reply[0] = HOST_REPLAY_MALFORMED;
+        break;
+      }
+      if (!can_replay_push(&frame, time_us))
+      {
+        reply[0] = (can_replay_free() == 0U) ? HOST_REPLAY_FULL : HOST_REPLAY_MALFORMED;
+        break;
+      }
+      stored++;
+      pos += 4U + used;
+    }
+    if ((reply[0] == HOST_REPLAY_OK) && ((packet->payload[0] & 0x01U) != 0U))
+    {
+      can_replay_end();
+    }
+  }
+  else if (packet->type == HOST_CMD_REPLAY_START)
+  {
+    uint32_t delay_us = 0U;
+
+    if (packet->len == 4U)
+    {
+      memcpy(&delay_us, packet->payload, 4U);
+    }
+    if (!can_replay_start(delay_us))
+    {
+      reply[0] = HOST_REPLAY_REFUSED;
+    }
+  }
+  else if (packet->type == HOST_CMD_REPLAY_STOP)
+  {
+    can_replay_stop();
+  }
+
+  uint16_t room = (uint16_t)can_replay_free();
+
+  can_replay_stats(&stats);
+  reply[1] = can_replay_running() ? 1U : 0U;
+  reply[2] = (uint8_t)stored;
+  memcpy(&reply[3], &room, 2U);
+  memcpy(&reply[5], &stats.released, 4U);
+  memcpy(&reply[9], &stats.sent, 4U);
+  memcpy(&reply[13], &stats.failed, 4U);
+  memcpy(&reply[17], &stats.underruns, 4U);
+  memcpy(&reply[21], &stats.min_error_us, 4U);
+  memcpy(&reply[25], &stats.max_error_us, 4U);
+  memcpy(&reply[29], &stats.mean_error_us, 4U);
+  memcpy(&reply[33], &stats.results_lost, 4U);
+  host_proto_send(HOST_MSG_REPLAY_STATUS, reply, sizeof(reply));
+}
+
+/**
+  * @brief  Send the per frame replay results as one HOST_MSG_REPLAY_RESULTS packet.
+  * @retval None
+  */
+static void send_replay_results(void)
+{
+  can_replay_result_t results[(HOST_PROTO_MAX_PAYLOAD - 4U) / HOST_REPLAY_RESULT];
+  uint8_t payload[4U + sizeof(results) / sizeof(results[0]) * HOST_REPLAY_RESULT];
+  can_replay_stats_t stats;
+
+  if (uart_tx_free() < HOST_PROTO_MAX_WIRE)
+  {
+    return;
+  }
+
+  uint32_t count = can_replay_results(results, sizeof(results) / sizeof(results[0]));
+  if (count == 0U)
+  {
+    return;
+  }
+
+  can_replay_stats(&stats);
+  memcpy(payload, &stats.results_lost, 4U);
+  for (uint32_t i = 0U; i < count; i++)
+  {
+    uint8_t *record = &payload[4U + i * HOST_REPLAY_RESULT];
+
+    memcpy(&record[0], &results[i].index, 2U);
+    record[2] = results[i].status;
+    memcpy(&record[3], &results[i].error_us, 4U);
+  }
+  host_proto_send(HOST_MSG_REPLAY_RESULTS, payload, 4U + count * HOST_REPLAY_RESULT);
+}
+
+/**
+  * @brief  Route the can_tx outcomes here. Call after can_tx_start.
+  * @retval None
+  */
+void host_tx_init(void)
+{
+  can_tx_set_done_callback(tx_done);
+}
+
+/**
+  * @brief  Apply HOST_CMD_SET_RETRY and answer with the policy in effect.
+  * @param  packet packet from host_proto_receive
+  * @retval None
+  */
+static void set_retry(const host_packet_t *packet)
+{
+  uint8_t reply[1U + 1U + 4U + 4U] = { HOST_RETRY_MALFORMED };
+  uint32_t limit;
+  uint32_t deadline_us;
+  uint32_t backoff_us;
+
+  if (packet->len == 9U)
+  {
+    memcpy(&deadline_us, &packet->payload[1], 4U);
+    memcpy(&backoff_us, &packet->payload[5], 4U);
+    can_tx_set_retry(packet->payload[0], deadline_us, backoff_us);
+    reply[0] = HOST_RETRY_OK;
+  }
+
+  can_tx_get_retry(&limit, &deadline_us, &backoff_us);
+  reply[1] = (uint8_t)limit;
+  memcpy(&reply[2], &deadline_us, 4U);
+  memcpy(&reply[6], &backoff_us, 4U);
+  host_proto_send(HOST_MSG_RETRY, reply, sizeof(reply));
+}
+
+/**
+  * @brief  Handle a TX side command.
+  * @param  packet packet from host_proto_receive
+  * @retval false if the packet is not a TX side command
+  */
+bool host_tx_handle(const host_packet_t *packet)
+{
+  switch (packet->type)
+  {
+    case HOST_CMD_TX:
+    case HOST_CMD_TX_TIMED:
+      transmit(packet);
+      break;
+    case HOST_CMD_GET_EXPIRED:
+      send_expired();
+      break;
+    case HOST_CMD_SCHED_LOAD:
+    case HOST_CMD_SCHED_START:
+    case HOST_CMD_SCHED_STOP:
+      schedule(packet);
+      break;
+    case HOST_CMD_SCHED_STATS:
+      send_sched_stats(packet);
+      break;
+    case HOST_CMD_LOAD_START:
+    case HOST_CMD_LOAD_STOP:
+    case HOST_CMD_LOAD_STATS:
+      load(packet);
+      break;
+    case HOST_CMD_REPLAY_DATA:
+    case HOST_CMD_REPLAY_START:
+    case HOST_CMD_REPLAY_STOP:
+    case HOST_CMD_REPLAY_STATUS:
+      replay(packet);
+      break;
+    case HOST_CMD_SET_RETRY:
+      set_retry(packet);
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+/**
+  * @brief  Generate load, service the TX queue and send confirmations and
+  *         replay results, call from the main loop.
+  * @retval None
+  */
+void host_tx_poll(void)
+{
+  can_load_poll();
+  can_tx_poll();
+
+  if (!host_link_switching())
+  {
+    send_confirmations();
+    send_replay_results();
+  }
+}
+
+/**
+  * @brief  Send TX counters and the worst queueing delay per priority class as text.
+  * @retval None
+  */
+void host_tx_report(void)
+{
+  char line[320];
+  int len = snprintf(line, sizeof(line), "tx sent=%lu failed=%lu rejected=%lu preempted=%lu retries=%lu give-ups=%lu expired=%lu hwm=%lu/%lu confirm lost=%lu max delay us:",
+                     (unsigned long)can_tx_sent(), (unsigned long)can_tx_failed(),
+                     (unsigned long)can_tx_rejected(), (unsigned long)can_tx_preempted(),
+                     (unsigned long)can_tx_retries(), (unsigned long)can_tx_give_ups(), (unsigned long)can_tx_expired(),
+                     (unsigned long)can_tx_high_water(), (unsigned long)CAN_TX_QUEUE_SIZE,
+                     (unsigned long)confirm_lost);
+
+  for (uint32_t cls = 0U; cls < CAN_TX_CLASSES; cls++)
+  {
+    len += snprintf(&line[len], sizeof(line) - (uint32_t)len, " %lu", (unsigned long)can_tx_max_delay(cls));
+  }
+
+  host_proto_send(HOST_MSG_TEXT, line, (uint32_t)len);
+}
+
@@ -10,7 +10,18 @@
 
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
-
+#include "can_rx.h"
+#include "uart_tx.h"
+#include "host_proto.h"
+#include "uart_rx.h"
+#include "timestamp.h"
+#include "can_filter.h"
+#ifdef HOST_PROTOCOL_SLCAN
+#include "slcan.h"
+#else
+#include "host_link.h"
+#include "host_rx.h"
+#endif
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -21,6 +32,10 @@
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
 
+// standard IDs below this are received through FIFO0, everything else through FIFO1
+// set to 0 to accept all frames into FIFO0 only, RX_FILTER_CONFIG uses can_filter_config.h instead
+#define RX_SPLIT_STD_ID 0x100U
+
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
@@ -31,17 +46,26 @@
 /* Private variables ---------------------------------------------------------*/
 CAN_HandleTypeDef hcan;
 
+CRC_HandleTypeDef hcrc;
+
+TIM_HandleTypeDef htim2;
+
 UART_HandleTypeDef huart2;
+DMA_HandleTypeDef hdma_usart2_rx;
+DMA_HandleTypeDef hdma_usart2_tx;
 
 /* USER CODE BEGIN PV */
-
+static volatile bool report_requested;
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
+static void MX_DMA_Init(void);
 static void MX_CAN_Init(void);
 static void MX_USART2_UART_Init(void);
+static void MX_TIM2_Init(void);
+static void MX_CRC_Init(void);
 /* USER CODE BEGIN PFP */
 
 /* USER CODE END PFP */
@@ -80,26 +104,37 @@ int main(void)
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
+  MX_DMA_Init();
   MX_CAN_Init();
   MX_USART2_UART_Init();
+  MX_CRC_Init();
+  MX_TIM2_Init();
   /* USER CODE BEGIN 2 */
 
-  static CAN_RxHeaderTypeDef rx;
-  static uint8_t buffer[8];
-
-  static CAN_FilterTypeDef rxFilter;
-  rxFilter.FilterMaskIdHigh = 0x0000;
-  rxFilter.FilterMaskIdLow = 0x0000;
-  rxFilter.FilterFIFOAssignment = CAN_FILTER_FIFO0;
-  rxFilter.FilterBank = 0;
-  rxFilter.FilterMode = CAN_FILTERMODE_IDMASK;
-  rxFilter.FilterScale = CAN_FILTERSCALE_32BIT;
-  rxFilter.FilterActivation = CAN_FILTER_ENABLE;
-  HAL_CAN_ConfigFilter(&hcan, &rxFilter);
+#ifdef RX_FILTER_CONFIG
+  can_filter_apply_config(&hcan);
+#else
+  can_rx_config_filters(&hcan, RX_SPLIT_STD_ID);
+#endif
+  uart_tx_init(&huart2);
+  timestamp_start(&htim2);
+
+#ifdef HOST_PROTOCOL_SLCAN
+  // the host opens the bus with O after selecting the bit rate
+  slcan_init(&hcan);
+  uart_rx_start(&huart2, NULL);
+#else
   HAL_CAN_Start(&hcan);
+  can_rx_start(&hcan);
+  host_rx_init(&hcan);
+
+  host_proto_init(&hcrc);
+  host_link_init(&huart2);
+  uart_rx_start(&huart2, host_proto_rx_parse);
 
   const char msg[] = "wasd";
-  HAL_UART_Transmit(&huart2, msg, sizeof(msg), HAL_MAX_DELAY);
+  host_proto_send(HOST_MSG_TEXT, msg, sizeof(msg) - 1U);
+#endif
 
   /* USER CODE END 2 */
 
@@ -108,11 +143,38 @@ int main(void)
   while (1)
   {
 
-    if(HAL_CAN_GetRxFifoFillLevel(&hcan, CAN_RX_FIFO0))
+    // frames are pulled out of the FIFOs by the CAN interrupts and streamed out by DMA,
+    // only move them from one ring to the other here and leave them in the CAN ring while the UART is behind
+#ifdef HOST_PROTOCOL_SLCAN
+    static can_frame_t frame;
+
+    slcan_process();
+
+    if(uart_tx_free() >= SLCAN_MAX_FRAME_LEN && can_rx_pop(&frame))
+    {
+      slcan_send_frame(&frame);
+    }
+#else
+    host_packet_t packet;
+
+    while(host_proto_receive(&packet))
+    {
+      if(!host_link_handle(&packet))
+      {
+        host_rx_handle(&packet);
+      }
+    }
+    host_link_poll();
+
+    // frames are the only traffic towards the host, no reserve needed
+    host_rx_poll(0U);
+
+    if(report_requested)
     {
-      HAL_CAN_GetRxMessage(&hcan, CAN_RX_FIFO0, &rx, buffer);
-      HAL_UART_Transmit(&huart2, buffer, rx.DLC, HAL_MAX_DELAY);
+      report_requested = false;
+      host_rx_report();
     }
+#endif
 
     /* USER CODE END WHILE */
 
@@ -160,6 +222,32 @@ void SystemClock_Config(void)
   }
 }
 
+/**
+  * @brief CRC Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_CRC_Init(void)
+{
+
+  /* USER CODE BEGIN CRC_Init 0 */
+
+  /* USER CODE END CRC_Init 0 */
+
+  /* USER CODE BEGIN CRC_Init 1 */
+
+  /* USER CODE END CRC_Init 1 */
+  hcrc.Instance = CRC;
+  if (HAL_CRC_Init(&hcrc) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  /* USER CODE BEGIN CRC_Init 2 */
+
+  /* USER CODE END CRC_Init 2 */
+
+}
+
 /**
   * @brief CAN Initialization Function
   * @param None
@@ -181,7 +269,7 @@ static void MX_CAN_Init(void)
   hcan.Init.SyncJumpWidth = CAN_SJW_1TQ;
   hcan.Init.TimeSeg1 = CAN_BS1_13TQ;
   hcan.Init.TimeSeg2 = CAN_BS2_2TQ;
-  hcan.Init.TimeTriggeredMode = DISABLE;
+  hcan.Init.TimeTriggeredMode = ENABLE;
   hcan.Init.AutoBusOff = DISABLE;
   hcan.Init.AutoWakeUp = DISABLE;
   hcan.Init.AutoRetransmission = DISABLE;
@@ -197,6 +285,69 @@ static void MX_CAN_Init(void)
 
 }
 
+/**
+  * @brief TIM2 Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_TIM2_Init(void)
+{
+
+  /* USER CODE BEGIN TIM2_Init 0 */
+
+  /* USER CODE END TIM2_Init 0 */
+
+  TIM_ClockConfigTypeDef sClockSourceConfig = {0};
+  TIM_MasterConfigTypeDef sMasterConfig = {0};
+  TIM_OC_InitTypeDef sConfigOC = {0};
+
+  /* USER CODE BEGIN TIM2_Init 1 */
+
+  // 64 MHz timer clock (APB1 prescaler 2) divided down to 1 us ticks
+  /* USER CODE END TIM2_Init 1 */
+  htim2.Instance = TIM2;
+  htim2.Init.Prescaler = 63;
+  htim2.Init.CounterMode = TIM_COUNTERMODE_UP;
+  htim2.Init.Period = 65535;
+  htim2.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+  htim2.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+  if (HAL_TIM_Base_Init(&htim2) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sClockSourceConfig.ClockSource = TIM_CLOCKSOURCE_INTERNAL;
+  if (HAL_TIM_ConfigClockSource(&htim2, &sClockSourceConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  if (HAL_TIM_OC_Init(&htim2) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sMasterConfig.MasterOutputTrigger = TIM_TRGO_RESET;
+  sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+  if (HAL_TIMEx_MasterConfigSynchronization(&htim2, &sMasterConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sConfigOC.OCMode = TIM_OCMODE_TIMING;
+  sConfigOC.Pulse = 0;
+  sConfigOC.OCPolarity = TIM_OCPOLARITY_HIGH;
+  sConfigOC.OCFastMode = TIM_OCFAST_DISABLE;
+  if (HAL_TIM_OC_ConfigChannel(&htim2, &sConfigOC, TIM_CHANNEL_1) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  if (HAL_TIM_OC_ConfigChannel(&htim2, &sConfigOC, TIM_CHANNEL_2) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  /* USER CODE BEGIN TIM2_Init 2 */
+
+  /* USER CODE END TIM2_Init 2 */
+
+}
+
 /**
   * @brief USART2 Initialization Function
   * @param None
@@ -230,6 +381,25 @@ static void MX_USART2_UART_Init(void)
 
 }
 
+/**
+  * Enable DMA controller clock
+  */
+static void MX_DMA_Init(void)
+{
+
+  /* DMA controller clock enable */
+  __HAL_RCC_DMA1_CLK_ENABLE();
+
+  /* DMA interrupt init */
+  /* DMA1_Channel6_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel6_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel6_IRQn);
+  /* DMA1_Channel7_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel7_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel7_IRQn);
+
+}
+
 /**
   * @brief GPIO Initialization Function
   * @param None
@@ -273,6 +443,19 @@ static void MX_GPIO_Init(void)
 
 /* USER CODE BEGIN 4 */
 
+/**
+  * @brief  EXTI line detection callback.
+  * @param  GPIO_Pin Specifies the pins connected EXTI line
+  * @retval None
+  */
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+{
+  if(GPIO_Pin == B1_Pin)
+  {
+    report_requested = true;
+  }
+}
+
 /* USER CODE END 4 */
 
 /**
@@ -10,7 +10,16 @@
 
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
-
+#include "can_tx.h"
+#include "can_sched.h"
+#include "timestamp.h"
+#include "uart_tx.h"
+#include "uart_rx.h"
+#include "host_proto.h"
+#include "host_link.h"
+#include "host_tx.h"
+#include "can_load.h"
+#include "can_replay.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -21,6 +30,14 @@
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
 
+// false: frames leave in CAN priority order, true: strictly in the order they were queued
+#define TX_FIFO_ORDER false
+
+// software retries after lost arbitration or a transmit error, SET_RETRY changes them
+#define TX_RETRIES           3U
+#define TX_RETRY_DEADLINE_US 10000U
+#define TX_RETRY_BACKOFF_US  250U
+
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
@@ -31,17 +48,26 @@
 /* Private variables ---------------------------------------------------------*/
 CAN_HandleTypeDef hcan;
 
+CRC_HandleTypeDef hcrc;
+
+TIM_HandleTypeDef htim2;
+
 UART_HandleTypeDef huart2;
+DMA_HandleTypeDef hdma_usart2_rx;
+DMA_HandleTypeDef hdma_usart2_tx;
 
 /* USER CODE BEGIN PV */
-
+static volatile bool report_requested;
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
+static void MX_DMA_Init(void);
 static void MX_CAN_Init(void);
 static void MX_USART2_UART_Init(void);
+static void MX_TIM2_Init(void);
+static void MX_CRC_Init(void);
 /* USER CODE BEGIN PFP */
 
 /* USER CODE END PFP */
@@ -80,21 +106,30 @@ int main(void)
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
+  MX_DMA_Init();
   MX_CAN_Init();
   MX_USART2_UART_Init();
+  MX_TIM2_Init();
+  MX_CRC_Init();
   /* USER CODE BEGIN 2 */
 
-  static uint8_t buffer[8] = {0};
-  static CAN_TxHeaderTypeDef tx;
-  tx.IDE = CAN_ID_STD;
-  tx.RTR = CAN_RTR_DATA;
-  tx.StdId = 0x10;
-  tx.ExtId = 0x1234;
-  tx.DLC = 8;
-
+  timestamp_start(&htim2);
   HAL_CAN_Start(&hcan);
+  can_tx_start(&hcan);
+  can_tx_set_fifo_mode(TX_FIFO_ORDER);
+  can_tx_set_retry(TX_RETRIES, TX_RETRY_DEADLINE_US, TX_RETRY_BACKOFF_US);
+  host_tx_init();
+  can_sched_init(&htim2);
+  can_load_init(&hcan);
+  can_replay_init(&htim2);
+
+  uart_tx_init(&huart2);
+  host_proto_init(&hcrc);
+  host_link_init(&huart2);
+  uart_rx_start(&huart2, host_proto_rx_parse);
+
   const char msg[] = "wasd";
-  HAL_UART_Transmit(&huart2, msg, sizeof(msg), HAL_MAX_DELAY);
+  host_proto_send(HOST_MSG_TEXT, msg, sizeof(msg) - 1U);
 
   /* USER CODE END 2 */
 
@@ -104,13 +139,23 @@ int main(void)
   {
     /* USER CODE END WHILE */
 
-    if(HAL_CAN_GetTxMailboxesFreeLevel(&hcan))
+    // the TX interrupt keeps all three mailboxes loaded from the queue
+    host_packet_t packet;
+
+    while(host_proto_receive(&packet))
     {
-      uint32_t pMailbox;
-      HAL_UART_Receive(&huart2, buffer, sizeof(buffer), HAL_MAX_DELAY);
-      HAL_UART_Transmit(&huart2, buffer, sizeof(buffer), HAL_MAX_DELAY);
-      uint32_t status = HAL_CAN_AddTxMessage(&hcan, &tx, buffer, &pMailbox);
-      HAL_UART_Transmit(&huart2, &status, sizeof(status), HAL_MAX_DELAY);
+      if(!host_link_handle(&packet))
+      {
+        host_tx_handle(&packet);
+      }
+    }
+    host_link_poll();
+    host_tx_poll();
+
+    if(report_requested)
+    {
+      report_requested = false;
+      host_tx_report();
     }
 
     /* USER CODE BEGIN 3 */
@@ -157,6 +202,32 @@ void SystemClock_Config(void)
   }
 }
 
+/**
+  * @brief CRC Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_CRC_Init(void)
+{
+
+  /* USER CODE BEGIN CRC_Init 0 */
+
+  /* USER CODE END CRC_Init 0 */
+
+  /* USER CODE BEGIN CRC_Init 1 */
+
+  /* USER CODE END CRC_Init 1 */
+  hcrc.Instance = CRC;
+  if (HAL_CRC_Init(&hcrc) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  /* USER CODE BEGIN CRC_Init 2 */
+
+  /* USER CODE END CRC_Init 2 */
+
+}
+
 /**
   * @brief CAN Initialization Function
   * @param None
@@ -180,7 +251,7 @@ static void MX_CAN_Init(void)
   hcan.Init.SyncJumpWidth = CAN_SJW_1TQ;
   hcan.Init.TimeSeg1 = CAN_BS1_13TQ;
   hcan.Init.TimeSeg2 = CAN_BS2_2TQ;
-  hcan.Init.TimeTriggeredMode = DISABLE;
+  hcan.Init.TimeTriggeredMode = ENABLE;
   hcan.Init.AutoBusOff = DISABLE;
   hcan.Init.AutoWakeUp = DISABLE;
   hcan.Init.AutoRetransmission = DISABLE;
@@ -196,6 +267,69 @@ static void MX_CAN_Init(void)
 
 }
 
+/**
+  * @brief TIM2 Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_TIM2_Init(void)
+{
+
+  /* USER CODE BEGIN TIM2_Init 0 */
+
+  /* USER CODE END TIM2_Init 0 */
+
+  TIM_ClockConfigTypeDef sClockSourceConfig = {0};
+  TIM_MasterConfigTypeDef sMasterConfig = {0};
+  TIM_OC_InitTypeDef sConfigOC = {0};
+
+  /* USER CODE BEGIN TIM2_Init 1 */
+
+  // 64 MHz timer clock (APB1 prescaler 2) divided down to 1 us ticks
+  /* USER CODE END TIM2_Init 1 */
+  htim2.Instance = TIM2;
+  htim2.Init.Prescaler = 63;
+  htim2.Init.CounterMode = TIM_COUNTERMODE_UP;
+  htim2.Init.Period = 65535;
+  htim2.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+  htim2.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+  if (HAL_TIM_Base_Init(&htim2) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sClockSourceConfig.ClockSource = TIM_CLOCKSOURCE_INTERNAL;
+  if (HAL_TIM_ConfigClockSource(&htim2, &sClockSourceConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  if (HAL_TIM_OC_Init(&htim2) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sMasterConfig.MasterOutputTrigger = TIM_TRGO_RESET;
+  sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+  if (HAL_TIMEx_MasterConfigSynchronization(&htim2, &sMasterConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sConfigOC.OCMode = TIM_OCMODE_TIMING;
+  sConfigOC.Pulse = 0;
+  sConfigOC.OCPolarity = TIM_OCPOLARITY_HIGH;
+  sConfigOC.OCFastMode = TIM_OCFAST_DISABLE;
+  if (HAL_TIM_OC_ConfigChannel(&htim2, &sConfigOC, TIM_CHANNEL_1) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  if (HAL_TIM_OC_ConfigChannel(&htim2, &sConfigOC, TIM_CHANNEL_2) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  /* USER CODE BEGIN TIM2_Init 2 */
+
+  /* USER CODE END TIM2_Init 2 */
+
+}
+
 /**
   * @brief USART2 Initialization Function
   * @param None
@@ -229,6 +363,25 @@ static void MX_USART2_UART_Init(void)
 
 }
 
+/**
+  * Enable DMA controller clock
+  */
+static void MX_DMA_Init(void)
+{
+
+  /* DMA controller clock enable */
+  __HAL_RCC_DMA1_CLK_ENABLE();
+
+  /* DMA interrupt init */
+  /* DMA1_Channel6_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel6_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel6_IRQn);
+  /* DMA1_Channel7_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel7_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel7_IRQn);
+
+}
+
 /**
   * @brief GPIO Initialization Function
   * @param None
@@ -272,6 +425,19 @@ static void MX_GPIO_Init(void)
 
 /* USER CODE BEGIN 4 */
 
+/**
+  * @brief  EXTI line detection callback.
+  * @param  GPIO_Pin Specifies the pins connected EXTI line
+  * @retval None
+  */
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+{
+  if(GPIO_Pin == B1_Pin)
+  {
+    report_requested = true;
+  }
+}
+
 /* USER CODE END 4 */
 
 /**
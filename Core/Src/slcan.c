@@ -0,0 +1,438 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <string.h>
+#include "slcan.h"
+#include "can_rx.h"
+#include "uart_rx.h"
+#include "uart_tx.h"
+
+/*
+ * slcan (Lawicel) ASCII protocol, enough for slcand to attach the bridge
+ * as a SocketCAN interface:
+ *
+ *   Sn  bit rate 0..8 (10k..1M)    O / L / C  open / listen only / close
+ *   tiiildd..  riiil               standard data / remote frame
+ *   Tiiiiiiiildd..  Riiiiiiiil     extended data / remote frame
+ *   Zn  timestamps off / on        V N F  version / serial / status flags
+ *
+ * Commands end with \r, answered with \r (z\r / Z\r after a transmit) or
+ * \a on error. Received frames use the frame syntax, optionally followed
+ * by a 4 digit millisecond timestamp.
+ */
+
+#define SLCAN_MAX_LINE 32U
+
+#define SLCAN_OK    "\r"
+#define SLCAN_ERROR "\a"
+
+/* Status flags returned by F */
+#define SLCAN_FLAG_RX_FULL       0x01U
+#define SLCAN_FLAG_ERROR_WARNING 0x04U
+#define SLCAN_FLAG_OVERRUN       0x08U
+#define SLCAN_FLAG_ERROR_PASSIVE 0x20U
+#define SLCAN_FLAG_BUS_ERROR     0x80U
+
+typedef struct
+{
+  uint16_t prescaler;
+  uint32_t bs1;
+  uint32_t bs2;
+} slcan_bit_timing_t;
+
+/* S0..S8 for PCLK1 = 32 MHz, sample point 87.5 % (80 % at 800k) */
+static const slcan_bit_timing_t bit_timings[] =
+{
+  { 200U, CAN_BS1_13TQ, CAN_BS2_2TQ }, /* 10 kbit/s */
+  { 100U, CAN_BS1_13TQ, CAN_BS2_2TQ }, /* 20 kbit/s */
+  {  40U, CAN_BS1_13TQ, CAN_BS2_2TQ }, /* 50 kbit/s */
+  {  20U, CAN_BS1_13TQ, CAN_BS2_2TQ }, /* 100 kbit/s */
+  {  16U, CAN_BS1_13TQ, CAN_BS2_2TQ }, /* 125 kbit/s */
+  {   8U, CAN_BS1_13TQ, CAN_BS2_2TQ }, /* 250 kbit/s */
+  {   4U, CAN_BS1_13TQ, CAN_BS2_2TQ }, /* 500 kbit/s */
+  {   2U, CAN_BS1_15TQ, CAN_BS2_4TQ }, /* 800 kbit/s */
+  {   2U, CAN_BS1_13TQ, CAN_BS2_2TQ }, /* 1 Mbit/s */
+};
+
+/* Two ASCII hex digits per byte, first digit in the low byte for a direct store */
+#define HEX_DIGIT(n) ((n) < 10U ? (0x30U + (n)) : (0x37U + (n)))
+#define HEX_PAIR(b) (uint16_t)(HEX_DIGIT((uint16_t)(b) >> 4) | (HEX_DIGIT((uint16_t)(b) & 0xFU) << 8))
+#define HEX_ROW(r) HEX_PAIR((r) + 0x0U), HEX_PAIR((r) + 0x1U), HEX_PAIR((r) + 0x2U), HEX_PAIR((r) + 0x3U), \
+                   HEX_PAIR((r) + 0x4U), HEX_PAIR((r) + 0x5U), HEX_PAIR((r) + 0x6U), HEX_PAIR((r) + 0x7U), \
+                   HEX_PAIR((r) + 0x8U), HEX_PAIR((r) + 0x9U), HEX_PAIR((r) + 0xAU), HEX_PAIR((r) + 0xBU), \
+                   HEX_PAIR((r) + 0xCU), HEX_PAIR((r) + 0xDU), HEX_PAIR((r) + 0xEU), HEX_PAIR((r) + 0xFU)
+
+static const uint16_t hex_pair[256] =
+{
+  HEX_ROW(0x00U), HEX_ROW(0x10U), HEX_ROW(0x20U), HEX_ROW(0x30U),
+  HEX_ROW(0x40U), HEX_ROW(0x50U), HEX_ROW(0x60U), HEX_ROW(0x70U),
+  HEX_ROW(0x80U), HEX_ROW(0x90U), HEX_ROW(0xA0U), HEX_ROW(0xB0U),
+  HEX_ROW(0xC0U), HEX_ROW(0xD0U), HEX_ROW(0xE0U), HEX_ROW(0xF0U),
+};
+
+/* Nibble value | 0x10 for hex digits, 0 for anything else */
+static const uint8_t hex_value[256] =
+{
+  ['0'] = 0x10U, ['1'] = 0x11U, ['2'] = 0x12U, ['3'] = 0x13U, ['4'] = 0x14U,
+  ['5'] = 0x15U, ['6'] = 0x16U, ['7'] = 0x17U, ['8'] = 0x18U, ['9'] = 0x19U,
+  ['A'] = 0x1AU, ['B'] = 0x1BU, ['C'] = 0x1CU, ['D'] = 0x1DU, ['E'] = 0x1EU, ['F'] = 0x1FU,
+  ['a'] = 0x1AU, ['b'] = 0x1BU, ['c'] = 0x1CU, ['d'] = 0x1DU, ['e'] = 0x1EU, ['f'] = 0x1FU,
+};
+
+static CAN_HandleTypeDef *can;
+static bool bus_open;
+static bool timestamps;
+static uint32_t last_full;
+static uint32_t last_lost;
+static uint8_t line[SLCAN_MAX_LINE];
+static uint32_t line_len;
+static bool line_overflow;
+
+/**
+  * @brief  Decode hex digits, four at a time while possible.
+  * @param  text digits, most significant first
+  * @param  digits number of digits, at most 8
+  * @param  value decoded value
+  * @retval true if all characters were hex digits
+  */
+static bool hex_decode(const uint8_t *text, uint32_t digits, uint32_t *value)
+{
+  uint32_t result = 0U;
+  uint32_t valid = 0x10U;
+  uint32_t i = 0U;
+
+  for (; i + 4U <= digits; i += 4U)
+  {
+    uint32_t d0 = hex_value[text[i]];
+    uint32_t d1 = hex_value[text[i + 1U]];
+    uint32_t d2 = hex_value[text[i + 2U]];
+    uint32_t d3 = hex_value[text[i + 3U]];
+    valid &= d0 & d1 & d2 & d3;
+    result = (result << 16) | ((d0 & 0xFU) << 12) | ((d1 & 0xFU) << 8) | ((d2 & 0xFU) << 4) | (d3 & 0xFU);
+  }
+  for (; i < digits; i++)
+  {
+    uint32_t d = hex_value[text[i]];
+    valid &= d;
+    result = (result << 4) | (d & 0xFU);
+  }
+
+  *value = result;
+  return valid != 0U;
+}
+
+/**
+  * @brief  Decode data bytes, two digits per byte.
+  * @param  text digits
+  * @param  count number of bytes
+  * @param  data destination
+  * @retval true if all characters were hex digits
+  */
+static bool hex_decode_bytes(const uint8_t *text, uint32_t count, uint8_t *data)
+{
+  uint32_t valid = 0x10U;
+
+  for (uint32_t i = 0U; i < count; i++)
+  {
+    uint32_t hi = hex_value[text[2U * i]];
+    uint32_t lo = hex_value[text[(2U * i) + 1U]];
+    valid &= hi & lo;
+    data[i] = (uint8_t)(((hi & 0xFU) << 4) | (lo & 0xFU));
+  }
+
+  return valid != 0U;
+}
+
+/**
+  * @brief  Encode a value as 2, 4 or 8 hex digits, one byte per table lookup.
+  * @param  out destination
+  * @param  value value to encode
+  * @param  bytes number of bytes of value, 1..4
+  * @retval pointer past the last digit
+  */
+static char *hex_encode(char *out, uint32_t value, uint32_t bytes)
+{
+  for (uint32_t i = bytes; i > 0U; i--)
+  {
+    memcpy(out, &hex_pair[(value >> (8U * (i - 1U))) & 0xFFU], 2U);
+    out += 2;
+  }
+  return out;
+}
+
+static void reply(const char *text)
+{
+  uart_tx_write(text, strlen(text));
+}
+
+/**
+  * @brief  Handle t, T, r and R.
+  * @retval true if the frame was placed in a TX mailbox
+  */
+static bool transmit(const uint8_t *cmd, uint32_t len)
+{
+  CAN_TxHeaderTypeDef header = {0};
+  uint8_t data[8];
+  uint32_t id_digits = ((cmd[0] == 'T') || (cmd[0] == 'R')) ? 8U : 3U;
+  uint32_t id;
+  uint32_t dlc;
+  uint32_t mailbox;
+
+  header.IDE = (id_digits == 8U) ? CAN_ID_EXT : CAN_ID_STD;
+  header.RTR = ((cmd[0] == 'r') || (cmd[0] == 'R')) ? CAN_RTR_REMOTE : CAN_RTR_DATA;
+
+  if ((len < 2U + id_digits) || !hex_decode(&cmd[1], id_digits, &id) ||
+      !hex_decode(&cmd[1U + id_digits], 1U, &dlc) || (dlc > 8U))
+  {
+    return false;
+  }
+  if ((header.IDE == CAN_ID_STD) ? (id > 0x7FFU) : (id > 0x1FFFFFFFU))
+  {
+    return false;
+  }
+
+  uint32_t data_len = (header.RTR == CAN_RTR_DATA) ? dlc : 0U;
+  if ((len != 2U + id_digits + (2U * data_len)) || !hex_decode_bytes(&cmd[2U + id_digits], data_len, data))
+  {
+    return false;
+  }
+
+  header.StdId = id;
+  header.ExtId = id;
+  header.DLC = dlc;
+
+  return HAL_CAN_AddTxMessage(can, &header, data, &mailbox) == HAL_OK;
+}
+
+static uint32_t status_flags(void)
+{
+  uint32_t esr = can->Instance->ESR;
+  uint32_t full = can_rx_fifo_full(CAN_RX_FIFO0) + can_rx_fifo_full(CAN_RX_FIFO1);
+  uint32_t lost = can_rx_dropped() + can_rx_fifo_overrun(CAN_RX_FIFO0) + can_rx_fifo_overrun(CAN_RX_FIFO1);
+  uint32_t flags = 0U;
+
+  if (full != last_full)
+  {
+    flags |= SLCAN_FLAG_RX_FULL;
+    last_full = full;
+  }
+  if (lost != last_lost)
+  {
+    flags |= SLCAN_FLAG_RX_FULL | SLCAN_FLAG_OVERRUN;
+    last_lost = lost;
+  }
+  if ((esr & CAN_ESR_EWGF) != 0U)
+  {
+    flags |= SLCAN_FLAG_ERROR_WARNING;
+  }
+  if ((esr & CAN_ESR_EPVF) != 0U)
+  {
+    flags |= SLCAN_FLAG_ERROR_PASSIVE;
+  }
+  if ((esr & (CAN_ESR_BOFF | CAN_ESR_LEC)) != 0U)
+  {
+    flags |= SLCAN_FLAG_BUS_ERROR;
+  }
+
+  return flags;
+}
+
+static void execute(const uint8_t *cmd, uint32_t len)
+{
+  char answer[8];
+
+  switch (cmd[0])
+  {
+    case 'S':
+      if (bus_open || (len != 2U) || (cmd[1] < '0') || (cmd[1] > '8'))
+      {
+        reply(SLCAN_ERROR);
+        break;
+      }
+      can->Init.Prescaler = bit_timings[cmd[1] - '0'].prescaler;
+      can->Init.TimeSeg1 = bit_timings[cmd[1] - '0'].bs1;
+      can->Init.TimeSeg2 = bit_timings[cmd[1] - '0'].bs2;
+      reply((HAL_CAN_Init(can) == HAL_OK) ? SLCAN_OK : SLCAN_ERROR);
+      break;
+
+    case 'O':
+    case 'L':
+      if (bus_open)
+      {
+        reply(SLCAN_ERROR);
+        break;
+      }
+      can->Init.Mode = (cmd[0] == 'L') ? CAN_MODE_SILENT : CAN_MODE_NORMAL;
+      bus_open = (HAL_CAN_Init(can) == HAL_OK) && (HAL_CAN_Start(can) == HAL_OK) && (can_rx_start(can) == HAL_OK);
+      reply(bus_open ? SLCAN_OK : SLCAN_ERROR);
+      break;
+
+    case 'C':
+      HAL_CAN_Stop(can);
+      bus_open = false;
+      reply(SLCAN_OK);
+      break;
+
+    case 't':
+    case 'T':
+    case 'r':
+    case 'R':
+      if (!bus_open || (can->Init.Mode != CAN_MODE_NORMAL) || !transmit(cmd, len))
+      {
+        reply(SLCAN_ERROR);
+        break;
+      }
+      reply(((cmd[0] == 't') || (cmd[0] == 'r')) ? "z\r" : "Z\r");
+      break;
+
+    case 'Z':
+      if ((len != 2U) || ((cmd[1] != '0') && (cmd[1] != '1')))
+      {
+        reply(SLCAN_ERROR);
+        break;
+      }
+      timestamps = (cmd[1] == '1');
+      reply(SLCAN_OK);
+      break;
+
+    case 'F':
+      answer[0] = 'F';
+      hex_encode(&answer[1], status_flags(), 1U);
+      answer[3] = '\r';
+      answer[4] = '\0';
+      reply(answer);
+      break;
+
+    case 'V':
+      reply("V0101\r");
+      break;
+
+    case 'N':
+      reply("NCS01\r");
+      break;
+
+    default:
+      reply(SLCAN_ERROR);
+      break;
+  }
+}
+
+/**
+  * @brief  Take over the CAN handle, the bus stays closed until O or L.
+  * @param  hcan pointer to an initialised CAN handle
+  * @retval None
+  */
+void slcan_init(CAN_HandleTypeDef *hcan)
+{
+  can = hcan;
+  bus_open = false;
+  timestamps = false;
+  line_len = 0U;
+  line_overflow = false;
+  last_full = can_rx_fifo_full(CAN_RX_FIFO0) + can_rx_fifo_full(CAN_RX_FIFO1);
+  last_lost = can_rx_dropped() + can_rx_fifo_overrun(CAN_RX_FIFO0) + can_rx_fifo_overrun(CAN_RX_FIFO1);
+}
+
+/**
+  * @brief  Execute all complete command lines received from the host.
+  * @retval None
+  */
+void slcan_process(void)
+{
+  uint8_t chunk[32];
+  uint32_t count;
+
+  while ((count = uart_rx_read(chunk, sizeof(chunk))) != 0U)
+  {
+    for (uint32_t i = 0U; i < count; i++)
+    {
+      uint8_t c = chunk[i];
+
+      if (c == '\r')
+      {
+        if (line_overflow || (line_len == 0U))
+        {
+          reply(line_overflow ? SLCAN_ERROR : SLCAN_OK);
+        }
+        else
+        {
+          execute(line, line_len);
+        }
+        line_len = 0U;
+        line_overflow = false;
+      }
+      else if (c == '\n')
+      {
+        /* some terminals send \r\n */
+      }
+      else if (line_len < SLCAN_MAX_LINE)
+      {
+        line[line_len++] = c;
+      }
+      else
+      {
+        line_overflow = true;
+      }
+    }
+  }
+}
+
+/**
+  * @brief  Queue a received frame in slcan syntax.
+  * @param  frame received frame record
+  * @retval true if queued
+  */
+bool slcan_send_frame(const can_frame_t *frame)
+{
+  char text[SLCAN_MAX_FRAME_LEN];
+  char *out = text;
+  uint32_t dlc = can_frame_dlc(frame);
+  bool rtr = can_frame_is_rtr(frame);
+
+  if (can_frame_is_ext(frame))
+  {
+    *out++ = rtr ? 'R' : 'T';
+    out = hex_encode(out, can_frame_id(frame), 4U);
+  }
+  else
+  {
+    /* three digits, the top nibble on its own */
+    uint32_t id = can_frame_id(frame);
+    *out++ = rtr ? 'r' : 't';
+    *out++ = (char)HEX_DIGIT(id >> 8);
+    out = hex_encode(out, id, 1U);
+  }
+  *out++ = (char)('0' + dlc);
+
+  if (!rtr)
+  {
+    /* two data bytes, four digits per 32-bit store */
+    const uint8_t *data = can_frame_data(frame);
+    uint32_t i = 0U;
+    for (; i + 2U <= dlc; i += 2U)
+    {
+      uint32_t digits = (uint32_t)hex_pair[data[i]] | ((uint32_t)hex_pair[data[i + 1U]] << 16);
+      memcpy(out, &digits, 4U);
+      out += 4;
+    }
+    if (i < dlc)
+    {
+      memcpy(out, &hex_pair[data[i]], 2U);
+      out += 2;
+    }
+  }
+
+  if (timestamps)
+  {
+    out = hex_encode(out, (uint32_t)((frame->time_us / 1000U) % 60000U), 2U);
+  }
+  *out++ = '\r';
+
+  return uart_tx_write(text, (uint32_t)(out - text));
+}
+
+bool slcan_is_open(void)
+{
+  return bus_open;
+}
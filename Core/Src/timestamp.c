@@ -0,0 +1,107 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "timestamp.h"
+
+/*
+ * Free-running 1 us counter: the 16-bit timer counts the low part, its
+ * update interrupt adds 0x10000 to the high part. 64 bits of microseconds
+ * do not wrap within the lifetime of the device.
+ *
+ * The compare channels of the same timer serve as alarms on this time
+ * base, each one handed to the module that registered for it.
+ */
+static TIM_HandleTypeDef *timer;
+static volatile uint64_t high;
+static timestamp_compare_t compare_callbacks[TIMESTAMP_CHANNELS];
+
+/**
+  * @brief  Start the free-running microsecond counter.
+  * @param  htim timer initialised with 1 us ticks and a period of 0xFFFF
+  * @retval HAL status
+  */
+HAL_StatusTypeDef timestamp_start(TIM_HandleTypeDef *htim)
+{
+  timer = htim;
+  high = 0U;
+
+  return HAL_TIM_Base_Start_IT(htim);
+}
+
+/**
+  * @brief  Current time since timestamp_start.
+  * @note   Callable from any context. All interrupts share one priority,
+  *         so inside the CAN interrupts a pending overflow is not counted
+  *         yet; UIF is checked to account for it.
+  * @retval microseconds
+  */
+uint64_t timestamp_now_us(void)
+{
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  uint64_t now = high;
+  uint32_t count = timer->Instance->CNT;
+
+  if ((timer->Instance->SR & TIM_SR_UIF) != 0U)
+  {
+    /* overflow not handled yet, the counter is read again after it */
+    count = timer->Instance->CNT;
+    now += 0x10000U;
+  }
+
+  __set_PRIMASK(primask);
+
+  return now + count;
+}
+
+/**
+  * @brief  Set the function called on a compare match of a channel.
+  * @param  channel TIM_CHANNEL_1 to TIM_CHANNEL_4
+  * @param  callback called from the timer interrupt, NULL to ignore the channel
+  * @retval None
+  */
+void timestamp_set_compare_callback(uint32_t channel, timestamp_compare_t callback)
+{
+  compare_callbacks[channel / TIM_CHANNEL_2] = callback;
+}
+
+/**
+  * @brief  Dispatch a compare match, called from TIM2_IRQHandler.
+  * @param  htim pointer to the timer handle
+  * @retval None
+  */
+void HAL_TIM_OC_DelayElapsedCallback(TIM_HandleTypeDef *htim)
+{
+  static const uint32_t channels[TIMESTAMP_CHANNELS] =
+  {
+    HAL_TIM_ACTIVE_CHANNEL_1, HAL_TIM_ACTIVE_CHANNEL_2, HAL_TIM_ACTIVE_CHANNEL_3, HAL_TIM_ACTIVE_CHANNEL_4
+  };
+
+  if (htim != timer)
+  {
+    return;
+  }
+
+  for (uint32_t index = 0U; index < TIMESTAMP_CHANNELS; index++)
+  {
+    if ((htim->Channel == channels[index]) && (compare_callbacks[index] != NULL))
+    {
+      compare_callbacks[index]();
+    }
+  }
+}
+
+/**
+  * @brief  Count a counter overflow, called from TIM2_IRQHandler.
+  * @param  htim pointer to the timer handle
+  * @retval None
+  */
+void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
+{
+  if (htim == timer)
+  {
+    high += 0x10000U;
+  }
+}
@@ -0,0 +1,186 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "uart_rx.h"
+
+/*
+ * USART2 RX runs on a circular DMA buffer started with
+ * HAL_UARTEx_ReceiveToIdle_DMA. The half transfer, transfer complete and
+ * idle line events report how far the DMA has written; every byte between
+ * the previous and the current position is either handed to the parser
+ * right there in the interrupt or, without a parser, left in the buffer for
+ * uart_rx_read. received counts all bytes ever written, so
+ * received % UART_RX_BUFFER_SIZE is the DMA position of the next byte.
+ */
+static UART_HandleTypeDef *uart;
+static uart_rx_parser_t stream_parser;
+static uint8_t buffer[UART_RX_BUFFER_SIZE];
+static uint32_t dma_pos;
+static volatile uint32_t received;
+static volatile uint32_t skip_to;
+static uint32_t consumed;
+static volatile uint32_t dropped;
+static volatile uint32_t errors;
+
+_Static_assert((UART_RX_BUFFER_SIZE & (UART_RX_BUFFER_SIZE - 1U)) == 0U, "UART_RX_BUFFER_SIZE must be a power of two");
+_Static_assert(UART_RX_BUFFER_SIZE <= 0xFFFFU, "UART_RX_BUFFER_SIZE exceeds the DMA transfer count");
+
+/**
+  * @brief  Arm circular reception, the buffer restarts at position 0.
+  * @retval None
+  */
+static void start_dma(void)
+{
+  dma_pos = 0U;
+  HAL_UARTEx_ReceiveToIdle_DMA(uart, buffer, UART_RX_BUFFER_SIZE);
+}
+
+/**
+  * @brief  Account for bytes between the last and the given DMA position.
+  * @param  pos DMA position, 0 to UART_RX_BUFFER_SIZE
+  * @retval None
+  */
+static void advance(uint32_t pos)
+{
+  uint32_t start = dma_pos;
+
+  if (pos == start)
+  {
+    return;
+  }
+
+  /* the DMA wrapped since the last event */
+  uint32_t first = (pos > start) ? pos - start : UART_RX_BUFFER_SIZE - start;
+  uint32_t second = (pos > start) ? 0U : pos;
+
+  if (stream_parser != NULL)
+  {
+    stream_parser(&buffer[start], first);
+    if (second != 0U)
+    {
+      stream_parser(buffer, second);
+    }
+  }
+
+  __DMB();
+  received += first + second;
+  dma_pos = (pos == UART_RX_BUFFER_SIZE) ? 0U : pos;
+}
+
+/**
+  * @brief  Start receiving from the host.
+  * @param  huart pointer to the UART handle, RX linked to a circular DMA
+  * @param  parser called from the interrupt with new bytes, NULL to
+  *         collect them with uart_rx_read instead
+  * @retval None
+  */
+void uart_rx_start(UART_HandleTypeDef *huart, uart_rx_parser_t parser)
+{
+  uart = huart;
+  stream_parser = parser;
+  received = 0U;
+  skip_to = 0U;
+  consumed = 0U;
+  start_dma();
+}
+
+/**
+  * @brief  Take received bytes out of the DMA buffer.
+  * @note   Only used without a parser. Bytes the DMA overwrote before they
+  *         were read are counted as dropped.
+  * @param  data destination
+  * @param  max capacity of data
+  * @retval number of bytes copied
+  */
+uint32_t uart_rx_read(uint8_t *data, uint32_t max)
+{
+  __disable_irq();
+  uint32_t end = received;
+  uint32_t skip = skip_to;
+  __enable_irq();
+
+  /* a receive error restarted the DMA at position 0 */
+  if ((int32_t)(skip - consumed) > 0)
+  {
+    consumed = skip;
+  }
+
+  uint32_t count = end - consumed;
+  if (count > UART_RX_BUFFER_SIZE)
+  {
+    dropped += count - UART_RX_BUFFER_SIZE;
+    consumed = end - UART_RX_BUFFER_SIZE;
+    count = UART_RX_BUFFER_SIZE;
+  }
+  if (count > max)
+  {
+    count = max;
+  }
+
+  __DMB();
+  for (uint32_t i = 0U; i < count; i++)
+  {
+    data[i] = buffer[(consumed + i) & (UART_RX_BUFFER_SIZE - 1U)];
+  }
+  consumed += count;
+
+  return count;
+}
+
+uint32_t uart_rx_dropped(void)
+{
+  return dropped;
+}
+
+uint32_t uart_rx_errors(void)
+{
+  return errors;
+}
+
+/**
+  * @brief  Reception event callback: half, full or idle line.
+  * @param  huart pointer to the UART handle
+  * @param  Size DMA position in the buffer
+  * @retval None
+  */
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size)
+{
+  if (huart != uart)
+  {
+    return;
+  }
+
+  advance(Size);
+}
+
+/**
+  * @brief  UART error callback, counts framing/noise/overrun and re-arms.
+  * @note   HAL aborts the DMA before calling this. Bytes written up to the
+  *         abort are still delivered, then reception restarts at position 0
+  *         and the stream is marked as broken.
+  * @param  huart pointer to the UART handle
+  * @retval None
+  */
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+  if (huart != uart)
+  {
+    return;
+  }
+
+  errors++;
+  advance(UART_RX_BUFFER_SIZE - __HAL_DMA_GET_COUNTER(uart->hdmarx));
+
+  if (stream_parser != NULL)
+  {
+    stream_parser(NULL, 0U);
+  }
+
+  /* realign received with the restarted DMA position */
+  uint32_t aligned = (received + UART_RX_BUFFER_SIZE - 1U) & ~(UART_RX_BUFFER_SIZE - 1U);
+  received = aligned;
+  skip_to = aligned;
+
+  start_dma();
+}
@@ -0,0 +1,153 @@
+// SPDX-FileCopyrightText: 2024 Marian Sauer
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <string.h>
+#include "uart_tx.h"
+
+/*
+ * Byte ring streamed to the host by DMA. The main loop appends at head,
+ * the transfer complete callback advances tail by the length of the
+ * finished transfer and starts the next contiguous run, so the CPU never
+ * touches the UART data register.
+ */
+static UART_HandleTypeDef *uart;
+static uint8_t buffer[UART_TX_BUFFER_SIZE];
+static volatile uint32_t head;
+static volatile uint32_t tail;
+static volatile uint32_t in_flight;
+static uint32_t high_water;
+static uint32_t dropped;
+
+_Static_assert((UART_TX_BUFFER_SIZE & (UART_TX_BUFFER_SIZE - 1U)) == 0U, "UART_TX_BUFFER_SIZE must be a power of two");
+
+/**
+  * @brief  Start a DMA transfer for the oldest contiguous run, if idle.
+  * @note   Called with interrupts disabled or from the TX complete callback.
+  * @retval None
+  */
+static void kick(void)
+{
+  uint32_t start = tail;
+  uint32_t pending = head - start;
+
+  if ((in_flight != 0U) || (pending == 0U))
+  {
+    return;
+  }
+
+  uint32_t offset = start & (UART_TX_BUFFER_SIZE - 1U);
+  uint32_t run = UART_TX_BUFFER_SIZE - offset;
+  if (run > pending)
+  {
+    run = pending;
+  }
+  if (run > 0xFFFFU)
+  {
+    run = 0xFFFFU;
+  }
+
+  if (HAL_UART_Transmit_DMA(uart, &buffer[offset], (uint16_t)run) == HAL_OK)
+  {
+    in_flight = run;
+  }
+}
+
+/**
+  * @brief  Attach the ring to a UART with a linked TX DMA channel.
+  * @param  huart pointer to the UART handle
+  * @retval None
+  */
+void uart_tx_init(UART_HandleTypeDef *huart)
+{
+  uart = huart;
+  head = 0U;
+  tail = 0U;
+  in_flight = 0U;
+}
+
+/**
+  * @brief  Queue bytes for the host, never blocks.
+  * @param  data bytes to send
+  * @param  len number of bytes
+  * @retval true if queued, false if there was not enough room (nothing queued)
+  */
+bool uart_tx_write(const void *data, uint32_t len)
+{
+  uint32_t start = head;
+
+  if (len > UART_TX_BUFFER_SIZE - (start - tail))
+  {
+    dropped++;
+    return false;
+  }
+
+  uint32_t offset = start & (UART_TX_BUFFER_SIZE - 1U);
+  uint32_t first = UART_TX_BUFFER_SIZE - offset;
+  if (first > len)
+  {
+    first = len;
+  }
+  memcpy(&buffer[offset], data, first);
+  memcpy(buffer, (const uint8_t *)data + first, len - first);
+
+  __DMB();
+  head = start + len;
+
+  uint32_t used = head - tail;
+  if (used > high_water)
+  {
+    high_water = used;
+  }
+
+  __disable_irq();
+  kick();
+  __enable_irq();
+
+  return true;
+}
+
+/**
+  * @brief  Free space in the ring.
+  * @retval number of bytes that can be queued
+  */
+uint32_t uart_tx_free(void)
+{
+  return UART_TX_BUFFER_SIZE - (head - tail);
+}
+
+/**
+  * @brief  Check that all queued bytes have left the UART.
+  * @retval true if nothing is queued or in flight
+  */
+bool uart_tx_idle(void)
+{
+  return (head == tail) && (in_flight == 0U);
+}
+
+uint32_t uart_tx_high_water(void)
+{
+  return high_water;
+}
+
+uint32_t uart_tx_dropped(void)
+{
+  return dropped;
+}
+
+/**
+  * @brief  Tx Transfer completed callback, re-arms DMA with the next run.
+  * @param  huart pointer to the UART handle
+  * @retval None
+  */
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+  if (huart != uart)
+  {
+    return;
+  }
+
+  tail += in_flight;
+  in_flight = 0U;
+  kick();
+}